@@ -0,0 +1,297 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+ 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Cats/Textcat/XML.hpp"
+
+#if defined(TEXTCAT_BENCH_RAPIDXML)
+#include "rapidxml.hpp"
+#endif
+#if defined(TEXTCAT_BENCH_PUGIXML)
+#include "pugixml.hpp"
+#endif
+
+#include "Corpus.hpp"
+
+using namespace Cats::Textcat;
+
+// Uses every callback, so that nothing is skipped
+class Sink : public XML::HandlerBase {
+    
+public:
+    
+    std::size_t total = 0;
+    
+public:
+    
+    void startElement(const char* /*name*/, std::size_t nameLength) { total += nameLength; }
+    void endElement(const char* /*name*/, std::size_t nameLength) { total += nameLength; }
+    void attribute(const char* /*name*/, std::size_t nameLength, const char* /*value*/, std::size_t valueLength) { total += nameLength + valueLength; }
+    void text(const char* /*value*/, std::size_t valueLength) { total += valueLength; }
+    void cdata(const char* /*value*/, std::size_t valueLength) { total += valueLength; }
+    void comment(const char* /*value*/, std::size_t valueLength) { total += valueLength; }
+    void processingInstruction(const char* /*name*/, std::size_t nameLength, const char* /*value*/, std::size_t valueLength) { total += nameLength + valueLength; }
+    
+};
+
+struct Result {
+    
+    std::string corpus;
+    std::string benchmark;
+    std::string flags;
+    std::size_t bytes;
+    double seconds;
+    
+};
+
+struct Options {
+    
+    std::size_t size = 8 << 20;
+    int repeat = 5;
+    const char* json = nullptr;
+    std::vector<const char*> files;
+    
+};
+
+// Keeps the results of the measured calls alive
+volatile std::size_t checksum;
+
+// Best time of the runs of f, with prepare run untimed before each
+template <typename P, typename F>
+double measure(int repeat, P prepare, F f) {
+    
+    double best = 0;
+    for(int i = 0; i < repeat; ++i) {
+        
+        prepare();
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(!i || seconds < best) best = seconds;
+        
+    }
+    return best;
+    
+}
+
+template <XML::Parser::Flag F>
+void parse(XML::Parser& parser, const std::string& input, std::vector<char>& /*buffer*/, Sink& sink, std::true_type) {
+    
+    parser.parse<F>(input.data(), input.size(), sink);
+    
+}
+template <XML::Parser::Flag F>
+void parse(XML::Parser& parser, const std::string& /*input*/, std::vector<char>& buffer, Sink& sink, std::false_type) {
+    
+    parser.parse<F>(buffer.data(), sink);
+    
+}
+template <XML::Parser::Flag F>
+double parse(const std::string& input, std::vector<char>& buffer, int repeat) {
+    
+    XML::Parser parser;
+    return measure(repeat, [&] { buffer.assign(input.begin(), input.end()); buffer.push_back(0); }, [&] {
+        
+        Sink sink;
+        parse<F>(parser, input, buffer, sink, std::integral_constant<bool, F & XML::Parser::Flag::NonDestructive>());
+        checksum += sink.total;
+        
+    });
+    
+}
+
+struct FlagSet {
+    
+    const char* name;
+    double (*parse)(const std::string& input, std::vector<char>& buffer, int repeat);
+    
+};
+
+const FlagSet FLAG_SETS[] = {
+    {"None", &parse<XML::Parser::Flag::None>},
+    {"Default", &parse<XML::Parser::Flag::Default>},
+    {"Default|NormalizeSpace", &parse<XML::Parser::Flag::Default | XML::Parser::Flag::NormalizeSpace>},
+    {"Default|ClosingTagValidate", &parse<XML::Parser::Flag::Default | XML::Parser::Flag::ClosingTagValidate>},
+    {"Default|StructuralIndex", &parse<XML::Parser::Flag::Default | XML::Parser::Flag::StructuralIndex>},
+    {"Default|NonDestructive", &parse<XML::Parser::Flag::Default | XML::Parser::Flag::NonDestructive>},
+    {"Default|NonDestructive|StructuralIndex",
+        &parse<XML::Parser::Flag::Default | XML::Parser::Flag::NonDestructive | XML::Parser::Flag::StructuralIndex>},
+};
+
+void run(const char* corpus, const std::string& input, const Options& options, std::vector<Result>& results) {
+    
+    std::vector<char> buffer;
+    auto add = [&](const char* benchmark, const char* flags, std::size_t bytes, double seconds) {
+        
+        results.push_back({corpus, benchmark, flags, bytes, seconds});
+        std::printf("%-12s %-20s %-40s %10.1f MB/s\n", corpus, benchmark, flags, bytes / seconds / 1e6);
+        std::fflush(stdout);
+        
+    };
+    auto copy = [&] { buffer.assign(input.begin(), input.end()); buffer.push_back(0); };
+    
+    for(auto& set : FLAG_SETS) add("Parser::parse", set.name, input.size(), set.parse(input, buffer, options.repeat));
+    
+    XML::Document document;
+    add("Document::parse", "Default", input.size(), measure(options.repeat, copy, [&] {
+        
+        document.parse<XML::Parser::Flag::Default>(buffer.data());
+        
+    }));
+    add("Document::parse", "Default|NonDestructive", input.size(), measure(options.repeat, [] {}, [&] {
+        
+        document.parse<XML::Parser::Flag::Default | XML::Parser::Flag::NonDestructive>(input.data(), input.size());
+        
+    }));
+    std::string output;
+    add("Document::serialize", "Default", input.size(), measure(options.repeat, [&] { output.clear(); }, [&] {
+        
+        document.serialize(output);
+        checksum += output.size();
+        
+    }));
+    add("Document::serialize", "Indent", input.size(), measure(options.repeat, [&] { output.clear(); }, [&] {
+        
+        document.serialize(output, XML::SerializerBase::Flag::Indent);
+        checksum += output.size();
+        
+    }));
+    
+#if defined(TEXTCAT_BENCH_RAPIDXML)
+    add("rapidxml", "parse_default", input.size(), measure(options.repeat, copy, [&] {
+        
+        rapidxml::xml_document<> doc;
+        doc.parse<rapidxml::parse_default>(buffer.data());
+        checksum += doc.first_node() != nullptr;
+        
+    }));
+#endif
+#if defined(TEXTCAT_BENCH_PUGIXML)
+    add("pugixml", "load_buffer_inplace", input.size(), measure(options.repeat, copy, [&] {
+        
+        pugi::xml_document doc;
+        checksum += doc.load_buffer_inplace(buffer.data(), input.size()).status;
+        
+    }));
+#endif
+    
+}
+
+void writeString(std::ostream& os, const std::string& str) {
+    
+    os << '"';
+    for(char c : str) {
+        
+        if(c == '"' || c == '\\') os << '\\' << c;
+        else if(static_cast<unsigned char>(c) < 0x20) { char escape[8]; std::snprintf(escape, sizeof(escape), "\\u%04x", c); os << escape; }
+        else os << c;
+        
+    }
+    os << '"';
+    
+}
+
+void writeJSON(std::ostream& os, const Options& options, const std::vector<Result>& results) {
+    
+    os << "{\n  \"size\": " << options.size << ",\n  \"repeat\": " << options.repeat << ",\n  \"results\": [";
+    for(std::size_t i = 0; i < results.size(); ++i) {
+        
+        auto& result = results[i];
+        os << (i ? ",\n    {" : "\n    {") << "\"corpus\": ";
+        writeString(os, result.corpus);
+        os << ", \"benchmark\": ";
+        writeString(os, result.benchmark);
+        os << ", \"flags\": ";
+        writeString(os, result.flags);
+        os << ", \"bytes\": " << result.bytes << ", \"seconds\": " << result.seconds
+            << ", \"mbps\": " << result.bytes / result.seconds / 1e6 << "}";
+        
+    }
+    os << "\n  ]\n}\n";
+    
+}
+
+std::string readFile(const char* name) {
+    
+    std::ifstream is(name, std::ios::binary);
+    if(!is) throw std::runtime_error(std::string("can't read file ") + name);
+    std::stringstream ss;
+    ss << is.rdbuf();
+    return ss.str();
+    
+}
+
+int main(int argc, char** argv) {
+    
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        
+        if(!std::strcmp(argv[i], "--size") && i + 1 < argc) options.size = std::stoul(argv[++i]);
+        else if(!std::strcmp(argv[i], "--repeat") && i + 1 < argc) options.repeat = std::max(1, std::stoi(argv[++i]));
+        else if(!std::strcmp(argv[i], "--json") && i + 1 < argc) options.json = argv[++i];
+        else if(argv[i][0] == '-') {
+            
+            std::cout << "usage: " << argv[0] << " [--size bytes] [--repeat count] [--json file] [file...]" << std::endl;
+            return 1;
+            
+        } else options.files.push_back(argv[i]);
+        
+    }
+    try {
+        
+        std::vector<Result> results;
+        for(auto& entry : Corpus::all()) run(entry.name, entry.generate(options.size), options, results);
+        for(auto file : options.files) run(file, readFile(file), options, results);
+        if(options.json) {
+            
+            std::ofstream os(options.json);
+            writeJSON(os, options, results);
+            if(!os) throw std::runtime_error("can't write result");
+            
+        }
+        
+    } catch(std::exception& e) {
+        
+        std::cout << "exception: " << e.what() << std::endl;
+        return 1;
+        
+    }
+    
+    return 0;
+    
+}
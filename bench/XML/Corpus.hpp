@@ -0,0 +1,225 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_BENCH_XML_CORPUS_HPP
+#define CATS_TEXTCAT_BENCH_XML_CORPUS_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+
+namespace Corpus {
+
+// Fixed-seed generator, so that a corpus is the same bytes on every run and platform
+class Random {
+    
+private:
+    
+    std::uint64_t state;
+    
+public:
+    
+    Random(std::uint64_t seed) : state(seed) {}
+    
+    std::uint32_t next() {
+        
+        state = state * 6364136223846793005u + 1442695040888963407u;
+        return static_cast<std::uint32_t>(state >> 33);
+        
+    }
+    std::size_t next(std::size_t n) { return next() % n; }
+    
+};
+
+inline void appendWord(std::string& out, Random& random) {
+    
+    static const char* const WORDS[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do", "eiusmod",
+        "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua", "enim", "minim", "veniam",
+    };
+    out += WORDS[random.next(sizeof(WORDS) / sizeof(*WORDS))];
+    
+}
+inline void appendNumber(std::string& out, Random& random) { out += std::to_string(random.next()); }
+
+// Elements with many short attributes and no text
+inline std::string attributes(std::size_t size) {
+    
+    Random random(1);
+    std::string out = "<?xml version=\"1.0\"?>\n<items>\n";
+    while(out.size() < size) {
+        
+        out += "  <item";
+        for(int i = 0; i < 12; ++i) {
+            
+            out += " a" + std::to_string(i) + "=\"";
+            if(i & 1) appendNumber(out, random); else appendWord(out, random);
+            out += '"';
+            
+        }
+        out += "/>\n";
+        
+    }
+    return out + "</items>\n";
+    
+}
+
+// Long paragraphs of text with little markup
+inline std::string text(std::size_t size) {
+    
+    Random random(2);
+    std::string out = "<?xml version=\"1.0\"?>\n<book>\n";
+    while(out.size() < size) {
+        
+        out += "  <p>";
+        for(std::size_t i = 0, n = 100 + random.next(200); i < n; ++i) {
+            
+            if(i) out += ' ';
+            appendWord(out, random);
+            
+        }
+        out += "</p>\n";
+        
+    }
+    return out + "</book>\n";
+    
+}
+
+// Chains of elements hundreds of levels deep
+inline std::string nested(std::size_t size) {
+    
+    Random random(3);
+    std::string out = "<?xml version=\"1.0\"?>\n<root>";
+    while(out.size() < size) {
+        
+        auto depth = 100 + random.next(400);
+        for(std::size_t i = 0; i < depth; ++i) out += "<n d=\"" + std::to_string(i) + "\">";
+        appendWord(out, random);
+        for(std::size_t i = 0; i < depth; ++i) out += "</n>";
+        
+    }
+    return out + "</root>\n";
+    
+}
+
+// Text and attribute values with an entity every few bytes
+inline std::string entities(std::size_t size) {
+    
+    static const char* const ENTITIES[] = { "&amp;", "&lt;", "&gt;", "&quot;", "&apos;" };
+    Random random(4);
+    std::string out = "<?xml version=\"1.0\"?>\n<escaped>\n";
+    while(out.size() < size) {
+        
+        out += "  <e v=\"";
+        appendWord(out, random);
+        out += ENTITIES[random.next(5)];
+        appendWord(out, random);
+        out += "\">";
+        for(int i = 0; i < 16; ++i) {
+            
+            appendWord(out, random);
+            out += ENTITIES[random.next(5)];
+            
+        }
+        out += "</e>\n";
+        
+    }
+    return out + "</escaped>\n";
+    
+}
+
+// A long list of small records, with the comments, CDATA and processing instructions of exported data
+inline std::string records(std::size_t size) {
+    
+    Random random(5);
+    std::string out = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!-- generated -->\n<records>\n";
+    for(std::size_t id = 0; out.size() < size; ++id) {
+        
+        out += "  <record id=\"" + std::to_string(id) + "\" status=\"";
+        out += random.next(4) ? "active" : "closed";
+        out += "\">\n    <name>";
+        appendWord(out, random);
+        out += ' ';
+        appendWord(out, random);
+        out += "</name>\n    <email>";
+        appendWord(out, random);
+        out += '@';
+        appendWord(out, random);
+        out += ".example</email>\n    <amount currency=\"EUR\">";
+        appendNumber(out, random);
+        out += "</amount>\n    <tags>";
+        for(std::size_t i = 0, n = random.next(4); i < n; ++i) {
+            
+            out += "<tag>";
+            appendWord(out, random);
+            out += "</tag>";
+            
+        }
+        out += "</tags>\n";
+        if(!random.next(8)) {
+            
+            out += "    <note><![CDATA[";
+            appendWord(out, random);
+            out += " <raw> & ";
+            appendWord(out, random);
+            out += "]]></note>\n";
+            
+        }
+        if(!random.next(16)) out += "    <!-- reviewed -->\n    <?audit checked?>\n";
+        out += "  </record>\n";
+        
+    }
+    return out + "</records>\n";
+    
+}
+
+struct Entry {
+    
+    const char* name;
+    std::string (*generate)(std::size_t size);
+    
+};
+
+inline std::vector<Entry> all() {
+    
+    return {
+        {"attributes", &attributes},
+        {"text", &text},
+        {"nested", &nested},
+        {"entities", &entities},
+        {"records", &records},
+    };
+    
+}
+
+}
+
+
+#endif
@@ -25,29 +25,13 @@
  */
  
 #include <exception>
-#include <fstream>
 #include <iostream>
-#include <stdexcept>
-#include <vector>
 
 #include "Cats/Textcat/XML.hpp"
+#include "Cats/Textcat/XML/MappedFile.hpp"
 
 using namespace Cats::Textcat;
 
-void readFile(const char* name, std::vector<char>& data) {
-    
-    std::size_t size;
-    std::ifstream is(name, std::ios::binary);
-    if(!is) throw std::runtime_error("can't read file");
-    is.seekg(0, std::ios::end);
-    size = is.tellg();
-    is.seekg(0);
-    data.resize(size + 1);
-    is.read(data.data(), size);
-    data[size] = 0;
-    
-}
-
 int main(int argc, char** argv) {
     
     std::ios::sync_with_stdio(false);
@@ -60,10 +44,9 @@ int main(int argc, char** argv) {
     }
     try {
         
-        std::vector<char> data;
-        readFile(argv[1], data);
+        XML::MappedFile file(argv[1], XML::MappedFile::Mode::Private);
         XML::Document document;
-        document.parse<XML::Parser::Flag::Default>(data.data());
+        document.parse<XML::Parser::Flag::Default>(file.getData());
         std::cout << document << std::endl;
         
     } catch(std::exception& e) {
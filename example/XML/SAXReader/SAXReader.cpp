@@ -24,12 +24,10 @@
  *
  */
 
-#include <fstream>
 #include <iostream>
-#include <stdexcept>
-#include <vector>
 
 #include "Cats/Textcat/XML.hpp"
+#include "Cats/Textcat/XML/MappedFile.hpp"
 
 using namespace Cats::Textcat;
 
@@ -62,7 +60,12 @@ public:
         indent(); std::cout << "endAttributes()\n";
         
     }
-    void doctype() { indent(); std::cout << "doctype()\n"; }
+    void doctype(const char* name, size_t /*nameLength*/, const char* publicId, size_t /*publicIdLength*/,
+        const char* systemId, size_t /*systemIdLength*/, const char* /*internalSubset*/, size_t internalSubsetLength) {
+        
+        indent(); std::cout << "doctype(\"" << name << "\", \"" << publicId << "\", \"" << systemId << "\", " << internalSubsetLength << ")\n";
+        
+    }
     void attribute(const char* name, size_t /*nameLength*/, const char* value, size_t /*valueLength*/) {
         
         indent(); std::cout << "attribute(\"" << name << "\", \"" << value << "\")\n";
@@ -91,20 +94,6 @@ public:
     
 };
 
-void readFile(const char* name, std::vector<char>& data) {
-    
-    std::size_t size;
-    std::ifstream is(name, std::ios::binary);
-    if(!is) throw std::runtime_error("can't read file");
-    is.seekg(0, std::ios::end);
-    size = is.tellg();
-    is.seekg(0);
-    data.resize(size + 1);
-    is.read(data.data(), size);
-    data[size] = 0;
-    
-}
-
 int main(int argc, char** argv) {
     
     std::ios::sync_with_stdio(false);
@@ -117,11 +106,10 @@ int main(int argc, char** argv) {
     }
     try {
         
-        std::vector<char> data;
-        readFile(argv[1], data);
+        XML::MappedFile file(argv[1], XML::MappedFile::Mode::Private);
         XML::Parser parser;
         Handler handler;
-        parser.parse<XML::Parser::Flag::Default>(data.data(), handler);
+        parser.parse<XML::Parser::Flag::Default>(file.getData(), handler);
         
     } catch(std::exception& e) {
         
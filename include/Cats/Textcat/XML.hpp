@@ -28,10 +28,17 @@
 #define CATS_TEXTCAT_XML_HPP
 
 
+#include "XML/BatchParser.hpp"
+#include "XML/CompactDOM.hpp"
 #include "XML/DOM.hpp"
+#include "XML/EventBuffer.hpp"
 #include "XML/Handler.hpp"
+#include "XML/ParallelParser.hpp"
 #include "XML/Parser.hpp"
+#include "XML/PipelineParser.hpp"
+#include "XML/Query.hpp"
 #include "XML/Serializer.hpp"
+#include "XML/Transform.hpp"
 
 
 #endif
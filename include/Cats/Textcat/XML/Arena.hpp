@@ -0,0 +1,240 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+ 
+#ifndef CATS_TEXTCAT_XML_ARENA_HPP
+#define CATS_TEXTCAT_XML_ARENA_HPP
+
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Bump allocator over a chain of blocks, freed all at once. With a retention, clear keeps one block that holds the
+// memory used since the last clear, up to the retention, so that reusing it for inputs of similar sizes stops allocating.
+class Arena {
+    
+private:
+    
+    struct Block {
+        
+        Block* next;
+        std::size_t size;
+        
+    };
+    
+    enum : std::size_t {
+        
+        ALIGNMENT = alignof(std::max_align_t),
+        HEADER = (sizeof(Block) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT,
+        MIN_BLOCK_SIZE = 4096 - HEADER,
+        MAX_BLOCK_SIZE = (1 << 20) - HEADER,
+        
+    };
+    
+private:
+    
+    Block* head;
+    char* cur;
+    char* end;
+    std::size_t retention;
+    std::size_t used;
+    
+private:
+    
+    static char* getData(Block* block) { return reinterpret_cast<char*>(block) + HEADER; }
+    
+    void use(Block* block) {
+        
+        head = block;
+        cur = getData(block);
+        end = cur + block->size;
+        
+    }
+    void push(std::size_t capacity) {
+        
+        auto block = static_cast<Block*>(std::malloc(HEADER + capacity));
+        if(!block) throw std::bad_alloc();
+        block->next = head;
+        block->size = capacity;
+        use(block);
+        
+    }
+    void grow(std::size_t size) {
+        
+        push(std::max<std::size_t>(size, head ? std::min<std::size_t>(head->size * 2, MAX_BLOCK_SIZE) : MIN_BLOCK_SIZE));
+        
+    }
+    
+public:
+    
+    Arena() : head(), cur(), end(), retention(), used() {}
+    Arena(const Arena& src) = delete;
+    ~Arena() { release(); }
+    
+    Arena& operator =(const Arena& src) = delete;
+    
+    void* allocate(std::size_t size) {
+        
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if(static_cast<std::size_t>(end - cur) < size) grow(size);
+        auto p = cur;
+        cur += size;
+        used += size;
+        return p;
+        
+    }
+    // Make the next size bytes come from one block
+    void reserve(std::size_t size) {
+        
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if(static_cast<std::size_t>(end - cur) < size) grow(size);
+        
+    }
+    
+    void clear() {
+        
+        std::size_t highWater = used;
+        used = 0;
+        if(!head) return;
+        std::size_t size = std::min(highWater, retention);
+        if(!size) { release(); return; }
+        Block* largest = head;
+        for(auto block = head; block; block = block->next) if(block->size > largest->size) largest = block;
+        if(largest->size >= size && largest->size <= retention) {
+            
+            for(auto block = head; block; ) {
+                
+                auto next = block->next;
+                if(block != largest) std::free(block);
+                block = next;
+                
+            }
+            largest->next = nullptr;
+            use(largest);
+            return;
+            
+        }
+        // Replace the chain by one block of the high-water mark, cut to the retention
+        release();
+        push(size);
+        
+    }
+    // Free all blocks, including a retained one
+    void release() {
+        
+        for(auto block = head; block; ) {
+            
+            auto next = block->next;
+            std::free(block);
+            block = next;
+            
+        }
+        head = nullptr;
+        cur = nullptr;
+        end = nullptr;
+        used = 0;
+        
+    }
+    
+    // Up to retention bytes are kept by clear, 0 frees everything
+    std::size_t getRetention() const { return retention; }
+    void setRetention(std::size_t retention_) { retention = retention_; }
+    
+    std::size_t getCapacity() const {
+        
+        std::size_t capacity = 0;
+        for(auto block = head; block; block = block->next) capacity += block->size;
+        return capacity;
+        
+    }
+    // Bytes allocated since the last clear, with alignment
+    std::size_t getSize() const { return used; }
+    
+};
+
+// Bump allocator over a buffer of the caller, which throws std::bad_alloc when the buffer is full instead of
+// falling back to the heap. It is moved rather than copied, so that only one owner hands out the buffer.
+class FixedArena {
+    
+private:
+    
+    enum : std::size_t { ALIGNMENT = alignof(std::max_align_t) };
+    
+private:
+    
+    char* begin;
+    char* cur;
+    char* end;
+    
+public:
+    
+    FixedArena() : begin(), cur(), end() {}
+    FixedArena(void* data, std::size_t size) : begin(static_cast<char*>(data)), cur(begin), end(begin + size) {}
+    FixedArena(const FixedArena& src) = delete;
+    FixedArena(FixedArena&& src) : begin(src.begin), cur(src.cur), end(src.end) { src.begin = src.cur = src.end = nullptr; }
+    
+    FixedArena& operator =(const FixedArena& src) = delete;
+    FixedArena& operator =(FixedArena&& src) {
+        
+        begin = src.begin;
+        cur = src.cur;
+        end = src.end;
+        src.begin = src.cur = src.end = nullptr;
+        return *this;
+        
+    }
+    
+    void* allocate(std::size_t size) {
+        
+        auto space = static_cast<std::size_t>(end - cur);
+        void* p = cur;
+        if(!std::align(ALIGNMENT, size, p, space)) throw std::bad_alloc();
+        cur = static_cast<char*>(p) + size;
+        return p;
+        
+    }
+    
+    void clear() { cur = begin; }
+    
+    std::size_t getCapacity() const { return end - begin; }
+    std::size_t getSize() const { return cur - begin; }
+    
+};
+
+}
+}
+}
+
+
+#endif
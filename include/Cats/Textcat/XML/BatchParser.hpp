@@ -0,0 +1,293 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_BATCHPARSER_HPP
+#define CATS_TEXTCAT_XML_BATCHPARSER_HPP
+
+
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "DOM.hpp"
+#include "Parser.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Parses batches of small documents on a pool of threads, the calling thread being one of them. Each thread
+// keeps a Parser, a Document and a buffer for in-situ copies across messages and batches, so a message costs
+// no setup. A batch is dealt out in one range of messages per thread, and a thread that has finished its range
+// takes the next messages of the others.
+class BatchParser {
+    
+public:
+    
+    struct Input {
+        
+        const char* data;
+        std::size_t size;
+        
+    };
+    
+private:
+    
+    struct Worker {
+        
+        Parser parser;
+        Document document;
+        std::vector<char> buffer;
+        // The messages of the range not taken yet by its thread or another one
+        std::atomic<std::size_t> next;
+        std::size_t end;
+        
+        Worker() : parser(), document(), buffer(), next(0), end(0) {}
+        
+    };
+    
+private:
+    
+    std::size_t threadCount;
+    std::size_t retention;
+    std::unique_ptr<Worker[]> workers;
+    std::vector<std::thread> threads;
+    
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    std::size_t generation;
+    std::size_t running;
+    bool exiting;
+    
+    // The current batch
+    void (*task)(void* context, Worker& worker, std::size_t index);
+    void* context;
+    std::atomic<bool> cancelled;
+    std::exception_ptr error;
+    
+private:
+    
+    template <typename T>
+    static void invoke(void* context, Worker& worker, std::size_t index) { (*static_cast<T*>(context))(worker, index); }
+    
+    // Run the task on the messages of the range of the thread, then on those left in the others
+    void work(std::size_t id) {
+        
+        for(std::size_t i = 0; i < threadCount; ++i) {
+            
+            auto& range = workers[(id + i) % threadCount];
+            while(!cancelled.load(std::memory_order_relaxed)) {
+                
+                auto index = range.next.fetch_add(1, std::memory_order_relaxed);
+                if(index >= range.end) break;
+                try {
+                    
+                    task(context, workers[id], index);
+                    
+                } catch(...) {
+                    
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(!error) error = std::current_exception();
+                    cancelled.store(true, std::memory_order_relaxed);
+                    
+                }
+                
+            }
+            
+        }
+        
+    }
+    void run(std::size_t id, std::size_t seen) {
+        
+        while(true) {
+            
+            {
+                
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&] { return exiting || generation != seen; });
+                if(exiting) return;
+                seen = generation;
+                
+            }
+            work(id);
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!--running) finished.notify_one();
+            
+        }
+        
+    }
+    void stop() {
+        
+        {
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            exiting = true;
+            
+        }
+        started.notify_all();
+        for(auto& thread : threads) thread.join();
+        threads.clear();
+        exiting = false;
+        
+    }
+    // Call t(worker, index) for each message index below count
+    template <typename T>
+    void dispatch(std::size_t count, T& t) {
+        
+        if(!count) return;
+        if(!workers) workers.reset(new Worker[threadCount]);
+        for(std::size_t i = 0; i < threadCount; ++i) {
+            
+            workers[i].document.setRetention(retention);
+            workers[i].next.store(count * i / threadCount, std::memory_order_relaxed);
+            workers[i].end = count * (i + 1) / threadCount;
+            
+        }
+        task = &invoke<T>;
+        context = &t;
+        cancelled.store(false, std::memory_order_relaxed);
+        error = nullptr;
+        {
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            while(threads.size() + 1 < threadCount) threads.emplace_back(&BatchParser::run, this, threads.size() + 1, generation);
+            running = threads.size();
+            ++generation;
+            
+        }
+        started.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return !running; });
+        if(error) std::rethrow_exception(error);
+        
+    }
+    
+    template <Parser::Flag F, typename H>
+    static Parser::Result parse(Worker& worker, const Input& input, H& handler, std::true_type) {
+        
+        return worker.parser.tryParse<F>(input.data, input.size, handler);
+        
+    }
+    template <Parser::Flag F, typename H>
+    static Parser::Result parse(Worker& worker, const Input& input, H& handler, std::false_type) {
+        
+        worker.buffer.assign(input.data, input.data + input.size);
+        worker.buffer.push_back(0);
+        return worker.parser.tryParse<F>(worker.buffer.data(), handler);
+        
+    }
+    template <Parser::Flag F>
+    static Parser::Result parse(Worker& worker, const Input& input, std::true_type) {
+        
+        return worker.document.tryParse<F>(input.data, input.size);
+        
+    }
+    template <Parser::Flag F>
+    static Parser::Result parse(Worker& worker, const Input& input, std::false_type) {
+        
+        worker.buffer.assign(input.data, input.data + input.size);
+        worker.buffer.push_back(0);
+        return worker.document.tryParse<F>(worker.buffer.data());
+        
+    }
+    
+public:
+    
+    static constexpr std::size_t DEFAULT_RETENTION = 1 << 20;
+    
+    BatchParser() : threadCount(std::max<std::size_t>(std::thread::hardware_concurrency(), 1)),
+        retention(DEFAULT_RETENTION), workers(), threads(), mutex(), started(), finished(), generation(0), running(0),
+        exiting(false), task(), context(), cancelled(false), error() {}
+    BatchParser(const BatchParser& src) = delete;
+    ~BatchParser() { stop(); }
+    
+    // Changing the count stops the threads and drops their documents, the next batch starts new ones
+    std::size_t getThreadCount() const { return threadCount; }
+    void setThreadCount(std::size_t threadCount_) {
+        
+        stop();
+        workers.reset();
+        threadCount = std::max<std::size_t>(threadCount_, 1);
+        
+    }
+    // Bytes of its pool each Document keeps between messages
+    std::size_t getRetention() const { return retention; }
+    void setRetention(std::size_t retention_) { retention = retention_; }
+    
+    // Parse each input with the handler returned by create(index), on any of the threads, and return the result
+    // of each as by Parser::tryParse. In-situ flags parse a copy in the buffer of the thread. An exception
+    // thrown by a handler stops the batch and is rethrown.
+    template <Parser::Flag F, typename C>
+    std::vector<Parser::Result> parse(const Input* inputs, std::size_t count, C create) {
+        
+        std::vector<Parser::Result> results(count);
+        auto t = [&](Worker& worker, std::size_t i) {
+            
+            auto handler = create(i);
+            results[i] = parse<F>(worker, inputs[i], handler, std::integral_constant<bool, F & Parser::Flag::NonDestructive>());
+            
+        };
+        dispatch(count, t);
+        return results;
+        
+    }
+    // Parse each input into the Document of one of the threads and call visit(index, document) there unless the
+    // input is malformed. The document is cleared by the next message of the thread, importNode keeps a copy
+    // of its nodes.
+    template <Parser::Flag F, typename V>
+    std::vector<Parser::Result> parseDocuments(const Input* inputs, std::size_t count, V visit) {
+        
+        std::vector<Parser::Result> results(count);
+        auto t = [&](Worker& worker, std::size_t i) {
+            
+            results[i] = parse<F>(worker, inputs[i], std::integral_constant<bool, F & Parser::Flag::NonDestructive>());
+            if(results[i]) visit(i, worker.document);
+            
+        };
+        dispatch(count, t);
+        return results;
+        
+    }
+    
+};
+
+}
+}
+}
+
+
+#endif
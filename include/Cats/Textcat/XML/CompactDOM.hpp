@@ -0,0 +1,504 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_COMPACTDOM_HPP
+#define CATS_TEXTCAT_XML_COMPACTDOM_HPP
+
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DOM.hpp"
+#include "Handler.hpp"
+#include "Parser.hpp"
+#include "Serializer.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Read-only document stored as arrays indexed by 32-bit ids. Node 0 is the document node, the children of a
+// node are linked through getFirstChild and getNextSibling, and the attributes of an element are a contiguous
+// range. Strings are offsets into the parsed buffer, which must outlive the document, except values that a
+// NonDestructive parse translated, which are copied. A document can be saved as a position-independent image,
+// which load uses in place.
+class CompactDocument {
+    
+public:
+    
+    using Index = std::uint32_t;
+    
+    enum : Index { NONE = 0xFFFFFFFF };
+    
+private:
+    
+    struct StringRef {
+        
+        std::uint32_t offset;
+        std::uint32_t length;
+        
+    };
+    
+    // Arrays read by the accessors, in the vectors after a parse or in the image after load
+    struct View {
+        
+        const Type* types;
+        const Index* firstChild;
+        const Index* nextSibling;
+        const StringRef* data;
+        const Index* attributeBegin;
+        const StringRef* attributeNames;
+        const StringRef* attributeValues;
+        const char* strings;
+        std::size_t nodeCount;
+        std::size_t attributeCount;
+        std::size_t stringSize;
+        
+    };
+    
+    // An image is this header followed by the arrays in the order of View, each aligned to 8 bytes, and the
+    // NUL-terminated strings. Offsets are from the start of the image.
+    struct ImageHeader {
+        
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t size;
+        std::uint64_t nodeCount;
+        std::uint64_t attributeCount;
+        std::uint64_t stringSize;
+        std::uint64_t offsets[8];
+        
+    };
+    
+    enum : std::uint32_t { IMAGE_VERSION = 1, IMAGE_BYTE_ORDER = 0x01020304 };
+    
+    class Handler : public HandlerBase {
+        
+    private:
+        
+        CompactDocument* document;
+        const Parser* parser;
+        std::vector<Index> stack;
+        std::vector<Index> last;
+        
+    private:
+        
+        StringRef store(const char* data, std::size_t length) {
+            
+            std::size_t offset;
+            if(parser && length && parser->isBuffered(data)) {
+                
+                offset = document->sourceSize + document->strings.size();
+                document->strings.insert(document->strings.end(), data, data + length);
+                
+            } else offset = data - document->source;
+            if(offset + length > std::numeric_limits<std::uint32_t>::max())
+                throw std::length_error("document too large");
+            return {static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(length)};
+            
+        }
+        Index create(Type type, const char* data, std::size_t length) {
+            
+            auto& d = *document;
+            if(d.types.size() >= NONE) throw std::length_error("too many nodes");
+            Index node = static_cast<Index>(d.types.size());
+            d.types.push_back(type);
+            d.firstChild.push_back(NONE);
+            d.nextSibling.push_back(NONE);
+            d.data.push_back(store(data, length));
+            d.attributeBegin.push_back(static_cast<Index>(d.attributeNames.size()));
+            if(last.back() == NONE) d.firstChild[stack.back()] = node;
+            else d.nextSibling[last.back()] = node;
+            last.back() = node;
+            return node;
+            
+        }
+        void createAttribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            auto& d = *document;
+            d.attributeNames.push_back(store(name, nameLength));
+            d.attributeValues.push_back(store(value, valueLength));
+            
+        }
+        
+    public:
+        
+        Handler(CompactDocument* document_, const Parser* parser_) : document(document_), parser(parser_), stack(), last() {}
+        
+        void startDocument() {
+            
+            auto& d = *document;
+            d.types.push_back(Type::Document);
+            d.firstChild.push_back(NONE);
+            d.nextSibling.push_back(NONE);
+            d.data.push_back({0, 0});
+            d.attributeBegin.push_back(0);
+            stack.assign(1, 0);
+            last.assign(1, NONE);
+            
+        }
+        void endDocument() {
+            
+            // Sentinel, so that the attributes of node i end where those of node i + 1 begin
+            document->attributeBegin.push_back(static_cast<Index>(document->attributeNames.size()));
+            
+        }
+        void startElement(const char* name, std::size_t nameLength) {
+            
+            stack.push_back(create(Type::Element, name, nameLength));
+            last.push_back(NONE);
+            
+        }
+        void endElement(const char* /*name*/, std::size_t /*nameLength*/) {
+            
+            stack.pop_back();
+            last.pop_back();
+            
+        }
+        void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            createAttribute(name, nameLength, value, valueLength);
+            
+        }
+        void text(const char* value, std::size_t valueLength) {
+            
+            create(Type::Text, value, valueLength);
+            
+        }
+        void cdata(const char* value, std::size_t valueLength) {
+            
+            create(Type::CDATA, value, valueLength);
+            
+        }
+        void comment(const char* value, std::size_t valueLength) {
+            
+            create(Type::Comment, value, valueLength);
+            
+        }
+        void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            // The content is kept as a single nameless attribute
+            create(Type::ProcessingInstruction, name, nameLength);
+            createAttribute(name, 0, value, valueLength);
+            
+        }
+        
+    };
+    
+private:
+    
+    const char* source;
+    std::size_t sourceSize;
+    std::vector<char> strings;
+    
+    std::vector<Type> types;
+    std::vector<Index> firstChild;
+    std::vector<Index> nextSibling;
+    std::vector<StringRef> data;
+    std::vector<Index> attributeBegin;
+    std::vector<StringRef> attributeNames;
+    std::vector<StringRef> attributeValues;
+    
+    View view;
+    
+private:
+    
+    String get(StringRef ref) const {
+        
+        return {ref.offset < sourceSize ? source + ref.offset : view.strings + (ref.offset - sourceSize), ref.length};
+        
+    }
+    void bind() {
+        
+        view = {types.data(), firstChild.data(), nextSibling.data(), data.data(), attributeBegin.data(),
+            attributeNames.data(), attributeValues.data(), strings.data(), types.size(), attributeNames.size(), strings.size()};
+        
+    }
+    static std::size_t align(std::size_t offset) { return (offset + 7) & ~std::size_t(7); }
+    void reserve(std::size_t size) {
+        
+        // Rough guess of one node per 32 bytes and one attribute per 64 bytes of input
+        std::size_t nodes = size / 32 + 1, attributes = size / 64;
+        types.reserve(nodes);
+        firstChild.reserve(nodes);
+        nextSibling.reserve(nodes);
+        data.reserve(nodes);
+        attributeBegin.reserve(nodes + 1);
+        attributeNames.reserve(attributes);
+        attributeValues.reserve(attributes);
+        
+    }
+    
+public:
+    
+    CompactDocument() : source(), sourceSize(), strings(), types(), firstChild(), nextSibling(), data(),
+        attributeBegin(), attributeNames(), attributeValues(), view() {}
+    CompactDocument(const CompactDocument& src) = delete;
+    
+    void clear() {
+        
+        source = nullptr;
+        sourceSize = 0;
+        strings.clear();
+        types.clear();
+        firstChild.clear();
+        nextSibling.clear();
+        data.clear();
+        attributeBegin.clear();
+        attributeNames.clear();
+        attributeValues.clear();
+        view = View();
+        
+    }
+    
+    template <Parser::Flag F>
+    void parse(char* data_) {
+        
+        assert(data_);
+        
+        clear();
+        source = data_;
+        // Declared entities may move values out of the input, which are then told apart by offset
+        sourceSize = F & Parser::Flag::InternalEntities ? std::strlen(data_) + 1 : std::numeric_limits<std::size_t>::max();
+        Parser parser;
+        Handler handler(this, F & Parser::Flag::InternalEntities ? &parser : nullptr);
+        parser.parse<F>(data_, handler);
+        bind();
+        
+    }
+    template <Parser::Flag F>
+    void parse(const char* data_, std::size_t size) {
+        
+        assert(data_ || !size);
+        
+        clear();
+        source = data_;
+        sourceSize = size;
+        reserve(size);
+        Parser parser;
+        Handler handler(this, &parser);
+        parser.parse<F>(data_, size, handler);
+        bind();
+        
+    }
+    
+    // Write the document with its strings as an image, which is still valid after the input is freed
+    void save(std::vector<char>& image) const {
+        
+        ImageHeader header = {};
+        std::memcpy(header.magic, "TCXMLDOM", 8);
+        header.version = IMAGE_VERSION;
+        header.byteOrder = IMAGE_BYTE_ORDER;
+        header.nodeCount = view.nodeCount;
+        header.attributeCount = view.attributeCount;
+        const std::size_t count[] = {view.nodeCount * sizeof(Type), view.nodeCount * sizeof(Index), view.nodeCount * sizeof(Index),
+            view.nodeCount * sizeof(StringRef), (view.nodeCount + 1) * sizeof(Index), view.attributeCount * sizeof(StringRef),
+            view.attributeCount * sizeof(StringRef)};
+        std::size_t offset = align(sizeof(ImageHeader));
+        for(std::size_t i = 0; i < 7; ++i) { header.offsets[i] = offset; offset = align(offset + count[i]); }
+        header.offsets[7] = offset;
+        std::size_t stringSize = 0;
+        for(std::size_t i = 0; i < view.nodeCount; ++i) stringSize += view.data[i].length + 1;
+        for(std::size_t i = 0; i < view.attributeCount; ++i) stringSize += view.attributeNames[i].length + view.attributeValues[i].length + 2;
+        image.reserve(offset + stringSize);
+        image.assign(offset, 0);
+        
+        // The strings are copied in document order and the references rewritten to them
+        auto copy = [&](StringRef ref) -> StringRef {
+            
+            auto str = get(ref);
+            StringRef result = {static_cast<std::uint32_t>(image.size() - offset), ref.length};
+            if(image.size() - offset + ref.length + 1 > std::numeric_limits<std::uint32_t>::max())
+                throw std::length_error("document too large");
+            image.insert(image.end(), str.getData(), str.getData() + ref.length);
+            image.push_back(0);
+            return result;
+            
+        };
+        std::vector<StringRef> nodeData(view.data, view.data + view.nodeCount);
+        std::vector<StringRef> names(view.attributeNames, view.attributeNames + view.attributeCount);
+        std::vector<StringRef> values(view.attributeValues, view.attributeValues + view.attributeCount);
+        for(std::size_t i = 0; i < view.nodeCount; ++i) nodeData[i] = copy(nodeData[i]);
+        for(std::size_t i = 0; i < view.attributeCount; ++i) { names[i] = copy(names[i]); values[i] = copy(values[i]); }
+        header.stringSize = image.size() - offset;
+        header.size = image.size();
+        
+        const void* arrays[] = {view.types, view.firstChild, view.nextSibling, nodeData.data(), view.attributeBegin, names.data(), values.data()};
+        std::memcpy(image.data(), &header, sizeof(header));
+        for(std::size_t i = 0; i < 7; ++i) if(count[i]) std::memcpy(image.data() + header.offsets[i], arrays[i], count[i]);
+        
+    }
+    // Use an image written by save, for example a MappedFile, without copying it. The image must outlive the
+    // document and be aligned to 8 bytes. Only the header and the bounds of the arrays are checked.
+    void load(const void* image, std::size_t size) {
+        
+        auto base = static_cast<const char*>(image);
+        ImageHeader header;
+        if(size < sizeof(header) || reinterpret_cast<std::uintptr_t>(base) % 8) throw std::runtime_error("invalid image");
+        std::memcpy(&header, base, sizeof(header));
+        if(std::memcmp(header.magic, "TCXMLDOM", 8) || header.version != IMAGE_VERSION || header.byteOrder != IMAGE_BYTE_ORDER
+            || header.size > size || header.nodeCount < 1 || header.nodeCount >= NONE || header.attributeCount >= NONE)
+            throw std::runtime_error("invalid image");
+        const std::uint64_t count[] = {header.nodeCount * sizeof(Type), header.nodeCount * sizeof(Index), header.nodeCount * sizeof(Index),
+            header.nodeCount * sizeof(StringRef), (header.nodeCount + 1) * sizeof(Index), header.attributeCount * sizeof(StringRef),
+            header.attributeCount * sizeof(StringRef), header.stringSize};
+        for(std::size_t i = 0; i < 8; ++i)
+            if(header.offsets[i] % (i < 7 ? 4 : 1) || header.offsets[i] > header.size || count[i] > header.size - header.offsets[i])
+                throw std::runtime_error("invalid image");
+        
+        clear();
+        source = base + header.offsets[7];
+        sourceSize = std::numeric_limits<std::size_t>::max();
+        view = {reinterpret_cast<const Type*>(base + header.offsets[0]), reinterpret_cast<const Index*>(base + header.offsets[1]),
+            reinterpret_cast<const Index*>(base + header.offsets[2]), reinterpret_cast<const StringRef*>(base + header.offsets[3]),
+            reinterpret_cast<const Index*>(base + header.offsets[4]), reinterpret_cast<const StringRef*>(base + header.offsets[5]),
+            reinterpret_cast<const StringRef*>(base + header.offsets[6]), source, static_cast<std::size_t>(header.nodeCount),
+            static_cast<std::size_t>(header.attributeCount), static_cast<std::size_t>(header.stringSize)};
+        
+    }
+    
+    std::size_t getNodeCount() const { return view.nodeCount; }
+    std::size_t getAttributeCount() const { return view.attributeCount; }
+    
+    Index getDocument() const { return 0; }
+    Type getType(Index node) const { return view.types[node]; }
+    Index getFirstChild(Index node) const { return view.firstChild[node]; }
+    Index getNextSibling(Index node) const { return view.nextSibling[node]; }
+    bool hasChildNodes(Index node) const { return view.firstChild[node] != NONE; }
+    
+    // Element type or processing instruction target
+    String getName(Index node) const { return view.types[node] == Type::Element || view.types[node] == Type::ProcessingInstruction ? get(view.data[node]) : String("", 0); }
+    // Content of text, CDATA, comment and processing instruction nodes
+    String getValue(Index node) const {
+        
+        switch(view.types[node]) {
+            
+        case Type::Text: case Type::CDATA: case Type::Comment: return get(view.data[node]);
+        case Type::ProcessingInstruction: return get(view.attributeValues[view.attributeBegin[node]]);
+        default: return String("", 0);
+        
+        }
+        
+    }
+    
+    // Attributes of an element are [getAttributeBegin(node), getAttributeEnd(node))
+    Index getAttributeBegin(Index node) const { return view.types[node] == Type::Element ? view.attributeBegin[node] : 0; }
+    Index getAttributeEnd(Index node) const { return view.types[node] == Type::Element ? view.attributeBegin[node + 1] : 0; }
+    String getAttributeName(Index attribute) const { return get(view.attributeNames[attribute]); }
+    String getAttributeValue(Index attribute) const { return get(view.attributeValues[attribute]); }
+    
+    // Bytes used by the node and attribute arrays and the copied strings
+    std::size_t getMemoryUsage() const {
+        
+        return view.nodeCount * (sizeof(Type) + 3 * sizeof(Index) + sizeof(StringRef))
+            + view.attributeCount * 2 * sizeof(StringRef) + view.stringSize;
+        
+    }
+    
+    template <typename W>
+    void serialize(BasicSerializer<W>& serializer) const {
+        
+        serializer.startDocument();
+        std::vector<Index> stack;
+        Index cur = getFirstChild(0);
+        while(cur != NONE) {
+            
+            switch(getType(cur)) {
+                
+            case Type::Element: {
+                
+                auto name = getName(cur);
+                serializer.startElement(name.getData(), name.getLength());
+                for(Index a = getAttributeBegin(cur), end = getAttributeEnd(cur); a != end; ++a) {
+                    
+                    auto attrName = getAttributeName(a);
+                    auto attrValue = getAttributeValue(a);
+                    serializer.attribute(attrName.getData(), attrName.getLength(), attrValue.getData(), attrValue.getLength());
+                    
+                }
+                serializer.endAttributes();
+                if(hasChildNodes(cur)) { stack.push_back(cur); cur = getFirstChild(cur); continue; }
+                serializer.endElement(name.getData(), name.getLength());
+                break;
+                
+            }
+            case Type::Text: { auto value = getValue(cur); serializer.text(value.getData(), value.getLength()); break; }
+            case Type::CDATA: { auto value = getValue(cur); serializer.cdata(value.getData(), value.getLength()); break; }
+            case Type::Comment: { auto value = getValue(cur); serializer.comment(value.getData(), value.getLength()); break; }
+            case Type::ProcessingInstruction: {
+                
+                auto name = getName(cur);
+                auto value = getValue(cur);
+                serializer.processingInstruction(name.getData(), name.getLength(), value.getData(), value.getLength());
+                break;
+                
+            }
+            default: throw std::runtime_error("invalid type");
+            
+            }
+            while(getNextSibling(cur) == NONE && !stack.empty()) {
+                
+                cur = stack.back();
+                stack.pop_back();
+                auto name = getName(cur);
+                serializer.endElement(name.getData(), name.getLength());
+                
+            }
+            cur = getNextSibling(cur);
+            
+        }
+        serializer.endDocument();
+        
+    }
+    void serialize(Corecat::Stream::Base& stream, SerializerBase::Flag flag = SerializerBase::Flag::Default) const {
+        
+        BufferedSerializer serializer(stream, flag);
+        serialize(serializer);
+        
+    }
+    void serialize(std::string& str, SerializerBase::Flag flag = SerializerBase::Flag::Default) const {
+        
+        StringSerializer serializer(str, flag);
+        serialize(serializer);
+        
+    }
+    
+};
+
+}
+}
+}
+
+
+#endif
@@ -29,16 +29,24 @@
 
 
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
+#include <algorithm>
 #include <new>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#include "Cats/Corecat/MemoryPool.hpp"
 #include "Cats/Corecat/Stream.hpp"
 
+#include "Arena.hpp"
 #include "Handler.hpp"
 #include "Parser.hpp"
+#include "Query.hpp"
 #include "Serializer.hpp"
 
 
@@ -46,10 +54,16 @@ namespace Cats {
 namespace Textcat{
 namespace XML {
 
+class Attribute;
+template <typename A>
+class BasicDocument;
+class Element;
 class Node;
 
 namespace Impl {
 
+class DocumentBase;
+
 template <typename T>
 class List {
     
@@ -111,11 +125,12 @@ public:
     
     T& insertBefore(T& child, T& ref) {
         
-        assert(!child->parent && ref->parent);
+        assert(!child.parent && ref.parent);
         auto pPrev = ref.prev;
         child.prev = pPrev;
         child.next = &ref;
         if(pPrev) pPrev->next = &child;
+        else first = &child;
         ref.prev = &child;
         child.parent = ref.parent;
         return child;
@@ -128,7 +143,7 @@ public:
         auto pNext = child.next;
         if(pPrev) pPrev->next = pNext;
         else first = pNext;
-        if(pNext) pNext->next = pPrev;
+        if(pNext) pNext->prev = pPrev;
         else last = pPrev;
         child.prev = nullptr;
         child.next = nullptr;
@@ -141,12 +156,167 @@ public:
     T& getLast() { return *last; }
     
     bool empty() { return !first; }
+    void clear() { first = nullptr; last = nullptr; }
     
     Iterator begin() { return Iterator(this, first); }
     Iterator end() { return Iterator(this, nullptr); }
     
 };
 
+// Open addressing table keyed by bytes, kept in a memory pool. An entry E starts with the key fields data,
+// length and hash, and its other fields are zero until set through insert.
+template <typename E, typename P>
+class HashTable {
+    
+private:
+    
+    P* pool;
+    E* table;
+    std::size_t mask;
+    std::size_t count;
+    
+private:
+    
+    E* find(const char* data, std::size_t length, std::uint32_t h) const {
+        
+        for(auto i = h & mask; ; i = (i + 1) & mask) {
+            
+            auto& entry = table[i];
+            if(!entry.data || (entry.hash == h && entry.length == length && (entry.data == data || !std::memcmp(entry.data, data, length))))
+                return &entry;
+            
+        }
+        
+    }
+    void allocate(std::size_t capacity) {
+        
+        // The old table stays in the pool until it is cleared
+        auto old = table;
+        auto oldCapacity = table ? mask + 1 : 0;
+        table = static_cast<E*>(pool->allocate(capacity * sizeof(E)));
+        std::memset(table, 0, capacity * sizeof(E));
+        mask = capacity - 1;
+        for(std::size_t i = 0; i < oldCapacity; ++i)
+            if(old[i].data) *find(old[i].data, old[i].length, old[i].hash) = old[i];
+        
+    }
+    
+public:
+    
+    HashTable(P* pool_) : pool(pool_), table(), mask(), count() {}
+    HashTable(const HashTable& src) = delete;
+    
+    static std::uint32_t hash(const char* data, std::size_t length) {
+        
+        std::uint32_t h = 2166136261u;
+        for(std::size_t i = 0; i < length; ++i) h = (h ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        return h;
+        
+    }
+    
+    // Make room for size entries without growing
+    void reserve(std::size_t size) {
+        
+        std::size_t capacity = 16;
+        while(capacity < size * 2) capacity *= 2;
+        if(!table || capacity > mask + 1) allocate(capacity);
+        
+    }
+    // Returns the entry with these bytes, added if there was none
+    E* insert(const char* data, std::size_t length) {
+        
+        if(!table) allocate(256);
+        else if((count + 1) * 2 > mask + 1) allocate((mask + 1) * 2);
+        auto h = hash(data, length);
+        auto entry = find(data, length, h);
+        if(!entry->data) {
+            
+            entry->data = data;
+            entry->length = static_cast<std::uint32_t>(length);
+            entry->hash = h;
+            ++count;
+            
+        }
+        return entry;
+        
+    }
+    E* lookup(const char* data, std::size_t length) const {
+        
+        if(!table) return nullptr;
+        auto entry = find(data, length, hash(data, length));
+        return entry->data ? entry : nullptr;
+        
+    }
+    
+    // All slots, empty ones with a null data
+    E* begin() const { return table; }
+    E* end() const { return table ? table + mask + 1 : table; }
+    
+    std::size_t size() const { return count; }
+    
+    void clear() { table = nullptr; mask = 0; count = 0; }
+    
+};
+
+// Set of names, kept in the memory pool of a document
+template <typename P>
+class NameTable {
+    
+private:
+    
+    struct Entry {
+        
+        const char* data;
+        std::uint32_t length;
+        std::uint32_t hash;
+        
+    };
+    
+private:
+    
+    HashTable<Entry, P> table;
+    
+public:
+    
+    NameTable(P* pool) : table(pool) {}
+    NameTable(const NameTable& src) = delete;
+    
+    // Returns the first pointer seen with the same bytes
+    const char* intern(const char* data, std::size_t length) { return table.insert(data, length)->data; }
+    const char* lookup(const char* data, std::size_t length) const {
+        
+        auto entry = table.lookup(data, length);
+        return entry ? entry->data : nullptr;
+        
+    }
+    
+    std::size_t size() const { return table.size(); }
+    
+    void clear() { table.clear(); }
+    
+};
+
+// Content of a lazy element, left unparsed in the input
+struct Deferred {
+    
+    void (*expand)(Element&);
+    DocumentBase* document;
+    char* base;
+    char* content;
+    std::size_t contentLength;
+    
+};
+
+struct AttributeSlot {
+    
+    const char* data;
+    std::uint32_t length;
+    std::uint32_t hash;
+    Attribute* attribute;
+    
+};
+using AttributeIndex = HashTable<AttributeSlot, DocumentBase>;
+
 }
 
 class String {
@@ -188,6 +358,15 @@ private:
     const Type type;
     Impl::List<Node> listChild;
     
+private:
+    
+    void expand();
+    
+protected:
+    
+    // Forget the children without unlinking them
+    void clearChildren() { listChild.clear(); }
+    
 public:
     
     Node(Type type_) : Impl::List<Node>::ListElement(), type(type_), listChild() {}
@@ -195,15 +374,16 @@ public:
     
     Type getType() const { return type; }
     
-    Impl::List<Node>& child() { return listChild; }
+    // The content of a lazy element is parsed on the first access to its children
+    Impl::List<Node>& child() { expand(); return listChild; }
     
-    Node& getFirstChild() { return listChild.getFirst(); }
-    Node& getLastChild() { return listChild.getLast(); }
+    Node& getFirstChild() { expand(); return listChild.getFirst(); }
+    Node& getLastChild() { expand(); return listChild.getLast(); }
     
-    Node& appendChild(Node& child) { return listChild.append(*this, child); }
+    Node& appendChild(Node& child) { expand(); return listChild.append(*this, child); }
     Node& insertBefore(Node& child, Node& ref) { return listChild.insertBefore(child, ref); }
     Node& removeChild(Node& child) { return listChild.remove(child); }
-    bool hasChildNodes() { return !listChild.empty(); }
+    bool hasChildNodes() { expand(); return !listChild.empty(); }
     
 };
 
@@ -228,27 +408,167 @@ public:
 
 class Element : public Node {
     
+    template <typename A>
+    friend class BasicDocument;
+    
 private:
     
     Impl::List<Attribute> listAttr;
     String name;
+    Impl::AttributeIndex* index;
+    Impl::Deferred* deferred;
     
 public:
     
-    Element() : Node(Type::Element), listAttr(), name() {}
-    Element(const String& name_) : Node(Type::Element), listAttr(), name(name_) {}
+    // Elements with more attributes than this are indexed by findAttribute
+    static constexpr std::size_t INDEX_THRESHOLD = 8;
+    
+    Element() : Node(Type::Element), listAttr(), name(), index(), deferred() {}
+    Element(const String& name_) : Node(Type::Element), listAttr(), name(name_), index(), deferred() {}
     Element(const Element& src) = delete;
     
+    // The list may be iterated freely, but attributes linked into it directly or renamed are not seen by
+    // an index built before until clearIndex is called
     Impl::List<Attribute>& attribute() { return listAttr; }
     
     Attribute& getFirstAttribute() { return listAttr.getFirst(); }
     Attribute& getLastAttribute() { return listAttr.getLast(); }
-    Attribute& appendAttribute(Attribute& attr) { return listAttr.append(*this, attr); }
-    Attribute& removeAttribute(Attribute& attr) { return listAttr.remove(attr); }
+    Attribute& appendAttribute(Attribute& attr) { index = nullptr; return listAttr.append(*this, attr); }
+    Attribute& removeAttribute(Attribute& attr) { index = nullptr; return listAttr.remove(attr); }
+    // The index is kept in the pool of the owning document and rebuilt after attributes are appended or removed
+    Attribute* findAttribute(const String& name);
+    void clearIndex() { index = nullptr; }
     String& getName() { return name; }
     
+    // Whether the content has been parsed, parse errors in a lazy content are thrown by expand
+    bool isExpanded() const { return !deferred; }
+    void expand() { if(deferred) deferred->expand(*this); }
+    
 };
 
+inline void Node::expand() {
+    
+    if(type == Type::Element) static_cast<Element*>(this)->expand();
+    
+}
+
+// Elements in document order
+class ElementList {
+    
+private:
+    
+    Element* const* first;
+    std::size_t count;
+    
+public:
+    
+    ElementList() : first(), count() {}
+    ElementList(Element* const* first_, std::size_t count_) : first(first_), count(count_) {}
+    
+    Element* const* begin() const { return first; }
+    Element* const* end() const { return first + count; }
+    Element& operator [](std::size_t i) const { return *first[i]; }
+    std::size_t size() const { return count; }
+    bool empty() const { return !count; }
+    
+};
+
+namespace Impl {
+
+// Elements of a document grouped by a key such as their name, kept in its memory pool
+template <typename P>
+class ElementIndex {
+    
+private:
+    
+    struct Entry {
+        
+        const char* data;
+        std::uint32_t length;
+        std::uint32_t hash;
+        Element** elements;
+        std::size_t count;
+        
+    };
+    
+private:
+    
+    P* pool;
+    HashTable<Entry, P> table;
+    Element** all;
+    std::size_t allCount;
+    bool built;
+    
+public:
+    
+    ElementIndex(P* pool_) : pool(pool_), table(pool_), all(), allCount(), built() {}
+    ElementIndex(const ElementIndex& src) = delete;
+    
+    bool isBuilt() const { return built; }
+    
+    // key(element) returns the key of the element, or nullptr to leave it out
+    template <typename K>
+    void build(const std::vector<Element*>& elements, K key) {
+        
+        clear();
+        // Count the elements of each key, then fill the lists in document order
+        for(auto element : elements) {
+            
+            auto name = key(*element);
+            if(name) ++table.insert(name->getData(), name->getLength())->count;
+            
+        }
+        for(auto entry = table.begin(); entry != table.end(); ++entry) {
+            
+            if(!entry->data) continue;
+            entry->elements = static_cast<Element**>(pool->allocate(entry->count * sizeof(Element*)));
+            entry->count = 0;
+            
+        }
+        for(auto element : elements) {
+            
+            auto name = key(*element);
+            if(!name) continue;
+            auto entry = table.lookup(name->getData(), name->getLength());
+            entry->elements[entry->count++] = element;
+            
+        }
+        allCount = elements.size();
+        all = static_cast<Element**>(pool->allocate(std::max<std::size_t>(allCount, 1) * sizeof(Element*)));
+        std::copy(elements.begin(), elements.end(), all);
+        built = true;
+        
+    }
+    
+    ElementList get(const char* data, std::size_t length) const {
+        
+        auto entry = table.lookup(data, length);
+        return entry ? ElementList(entry->elements, entry->count) : ElementList();
+        
+    }
+    ElementList getAll() const { return {all, allCount}; }
+    
+    // The tables stay in the pool until it is cleared
+    void clear() { table.clear(); all = nullptr; allCount = 0; built = false; }
+    
+};
+
+// Elements by the value of one attribute, one per attribute name that was queried
+template <typename P>
+struct ValueIndex {
+    
+    const char* name;
+    std::size_t nameLength;
+    ElementIndex<P> index;
+    ValueIndex* next;
+    
+    ValueIndex(P* pool, const char* name_, std::size_t nameLength_, ValueIndex* next_) :
+        name(name_), nameLength(nameLength_), index(pool), next(next_) {}
+    
+};
+
+}
+
 class Text : public Node {
     
 private:
@@ -316,121 +636,639 @@ public:
     
 };
 
-class Document : public Node {
+namespace Impl {
+
+// The part of a document that does not depend on its allocator, reached by the elements it owns
+class DocumentBase : public Node {
     
-private:
+    friend class XML::Element;
+    template <typename E, typename P>
+    friend class HashTable;
+    
+protected:
+    
+    void* pool;
+    void* (*allocatePool)(void*, std::size_t);
+    NameTable<DocumentBase> names;
+    bool nameInterning;
     
-    Corecat::MemoryPoolFast<> memoryPool;
+protected:
+    
+    DocumentBase(void* pool_, void* (*allocatePool_)(void*, std::size_t)) :
+        Node(Type::Document), pool(pool_), allocatePool(allocatePool_), names(this), nameInterning(false) {}
+    DocumentBase(const DocumentBase& src) = delete;
+    
+    void* allocate(std::size_t size) { return allocatePool(pool, size); }
     
 public:
     
-    Document() : Node(Type::Document), memoryPool() {}
-    Document(const Document& src) = delete;
+    // With name interning, parsed element and attribute names with the same bytes share one data pointer
+    bool isNameInterning() const { return nameInterning; }
+    void setNameInterning(bool nameInterning_) { nameInterning = nameInterning_; }
     
-    Element& createElement(const String& name) {
+    // The first name interned with these bytes, which must outlive the document
+    String intern(String name) {
         
-        return *new(memoryPool.allocate(sizeof(Element))) Element(name);
+        return {names.intern(name.getData(), name.getLength()), name.getLength()};
         
     }
-    Attribute& createAttribute(const String& name, const String& value) {
+    // Replaces name with its interned copy, or returns false if no element or attribute has this name
+    bool findName(String& name) const {
         
-        return *new(memoryPool.allocate(sizeof(Attribute))) Attribute(name, value);
+        auto data = names.lookup(name.getData(), name.getLength());
+        if(!data) return false;
+        name.set(data, name.getLength());
+        return true;
         
     }
-    Text& createText(const String& value) {
+    
+};
+
+template <typename A, typename = void>
+struct HasReserve : std::false_type {};
+template <typename A>
+struct HasReserve<A, decltype(std::declval<A&>().reserve(std::size_t()))> : std::true_type {};
+template <typename A, typename = void>
+struct HasSize : std::false_type {};
+template <typename A>
+struct HasSize<A, decltype(void(std::declval<const A&>().getSize()))> : std::true_type {};
+
+}
+
+// A document allocates its nodes and copied strings from an allocator of type A, which has
+// void* allocate(std::size_t size) returning memory aligned for any node and void clear() freeing all of it.
+// reserve(std::size_t size), getRetention, setRetention, getCapacity and getSize are used when A has them.
+template <typename A>
+class BasicDocument : public Impl::DocumentBase {
+    
+public:
+    
+    struct Statistics {
         
-        return *new(memoryPool.allocate(sizeof(Text))) Text(value);
+        // Nodes of each Type, indexed by its value
+        std::size_t nodes[static_cast<std::size_t>(Type::Document) + 1];
+        std::size_t attributes;
+        // Elements whose lazy content has not been parsed
+        std::size_t deferred;
+        // Bytes allocated from the pool since the last clear
+        std::size_t memoryUsed;
         
-    }
-    CDATA& createCDATA(const String& value) {
+    };
+    
+private:
+    
+    A memoryPool;
+    std::size_t lazyDepth;
+    std::size_t reservation;
+    // Kept to reuse its buffers
+    Parser parser;
+    Impl::ElementIndex<A> elementIndex;
+    Impl::ValueIndex<A>* valueIndex;
+    
+private:
+    
+    class Handler : public HandlerBase {
         
-        return *new(memoryPool.allocate(sizeof(CDATA))) CDATA(value);
+    private:
         
-    }
-    Comment& createComment(const String& value) {
+        BasicDocument* document;
+        const Parser* parser;
+        Node* cur;
+        std::size_t depth;
         
-        return *new(memoryPool.allocate(sizeof(Comment))) Comment(value);
+        // Lazy mode
+        void (*expand)(Element&);
+        char* base;
         
-    }
-    ProcessingInstruction& createProcessingInstruction(const String& name, const String& value) {
+    private:
         
-        return *new(memoryPool.allocate(sizeof(ProcessingInstruction))) ProcessingInstruction(name, value);
+        // Values translated into the buffer of the parser only live until the callback returns. The copy
+        // stays NUL-terminated like in-situ values.
+        String store(const char* data, std::size_t length) {
+            
+            if(!parser || !length || !parser->isBuffered(data)) return {data, length};
+            auto copy = static_cast<char*>(document->memoryPool.allocate(length + 1));
+            std::memcpy(copy, data, length);
+            copy[length] = 0;
+            return {copy, length};
+            
+        }
+        String storeName(const char* name, std::size_t nameLength) {
+            
+            if(!document->nameInterning) return {name, nameLength};
+            return {document->names.intern(name, nameLength), nameLength};
+            
+        }
         
-    }
+    public:
+        
+        Handler(BasicDocument* document_, const Parser* parser_, void (*expand_)(Element&), char* base_) :
+            document(document_), parser(parser_), cur(nullptr), depth(0), expand(expand_), base(base_) {}
+        
+        // Parse into the content of element instead of the document
+        void setElement(Element* element) { cur = element; }
+        
+        void startDocument() { cur = document; }
+        void startElement(const char* name, std::size_t nameLength) {
+            
+            auto& element = document->createElement(storeName(name, nameLength));
+            cur->appendChild(element);
+            cur = &element;
+            ++depth;
+            
+        }
+        void endElement(const char* /*name*/, std::size_t /*nameLength*/) {
+            
+            cur = cur->parent;
+            --depth;
+            
+        }
+        Directive endAttributes() {
+            
+            return depth == document->lazyDepth ? Directive::Skip : Directive::Continue;
+            
+        }
+        void skipped(const char* content, std::size_t contentLength) {
+            
+            if(!contentLength) return;
+            static_cast<Element*>(cur)->deferred = new(document->memoryPool.allocate(sizeof(Impl::Deferred)))
+                Impl::Deferred{expand, document, base, const_cast<char*>(content), contentLength};
+            
+        }
+        void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            static_cast<Element*>(cur)->appendAttribute(document->createAttribute(storeName(name, nameLength), store(value, valueLength)));
+            
+        }
+        void text(const char* value, std::size_t valueLength) {
+            
+            cur->appendChild(document->createText(store(value, valueLength)));
+            
+        }
+        void cdata(const char* value, std::size_t valueLength) {
+            
+            cur->appendChild(document->createCDATA({value, valueLength}));
+            
+        }
+        void comment(const char* value, std::size_t valueLength) {
+            
+            cur->appendChild(document->createComment({value, valueLength}));
+            
+        }
+        void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            cur->appendChild(document->createProcessingInstruction({name, nameLength}, {value, valueLength}));
+            
+        }
+        
+    };
     
-    void clear() {
+    // Whether element has the name and the attributes of step i of the query
+    static bool matches(const Query& query, Element& element, std::size_t i) {
         
-        memoryPool.clear();
+        auto& step = query.steps[i];
+        if(!step.any && !Query::equal(step.name, element.getName().getData(), element.getName().getLength())) return false;
+        for(std::size_t j = 0; j < query.predicates.size(); ++j) {
+            
+            if(!(step.predicates & (std::uint64_t(1) << j))) continue;
+            auto& predicate = query.predicates[j];
+            auto attr = element.findAttribute({predicate.name.data(), predicate.name.size()});
+            if(!attr || (predicate.hasValue && !Query::equal(predicate.value, attr->getValue().getData(), attr->getValue().getLength())))
+                return false;
+            
+        }
+        return true;
+        
+    }
+    // Whether element matches the last step of the query and its ancestors the steps before. As in QueryHandler,
+    // the steps each ancestor may match are kept in a bit set from the top down, so that the cost is the depth
+    // times the steps. path is scratch space for the ancestors.
+    static bool selects(const Query& query, Element& element, std::vector<Element*>& path) {
+        
+        path.clear();
+        Node* cur = &element;
+        for(; cur && cur->getType() == Type::Element; cur = cur->parent) path.push_back(static_cast<Element*>(cur));
+        // Steps that the next element down may match
+        std::uint64_t active = (cur && cur->getType() == Type::Document) || (query.descendants & 1) ? 1 : 0;
+        std::uint64_t matched = 0;
+        std::size_t last = query.steps.size() - 1;
+        for(auto it = path.rbegin(); it != path.rend(); ++it) {
+            
+            if(!active) return false;
+            // Only the element itself may match the last step
+            auto candidates = it + 1 == path.rend() ? active & (std::uint64_t(1) << last) : active & ~(std::uint64_t(1) << last);
+            matched = 0;
+            for(std::size_t i = 0; i <= last; ++i)
+                if(candidates & (std::uint64_t(1) << i) && matches(query, **it, i)) matched |= std::uint64_t(1) << i;
+            active = (matched << 1) | (active & query.descendants);
+            
+        }
+        return matched & (std::uint64_t(1) << last);
         
     }
     
-    template <Parser::Flag F>
-    void parse(char* data) {
+    static void* allocateFrom(void* pool, std::size_t size) { return static_cast<A*>(pool)->allocate(size); }
+    
+    // Bytes of the strings of a node copied with their terminating NULs
+    static std::size_t getStringSize(Node& node) {
         
-        class Handler : public HandlerBase {
+        switch(node.getType()) {
             
-        private:
+        case Type::Element: {
             
-            Document* document;
-            Node* cur;
+            auto& element = static_cast<Element&>(node);
+            std::size_t size = element.getName().getLength() + 1;
+            for(auto& attr : element.attribute()) size += attr.getName().getLength() + attr.getValue().getLength() + 2;
+            return size;
             
-        public:
+        }
+        case Type::Text: return static_cast<Text&>(node).getValue().getLength() + 1;
+        case Type::CDATA: return static_cast<CDATA&>(node).getValue().getLength() + 1;
+        case Type::Comment: return static_cast<Comment&>(node).getValue().getLength() + 1;
+        case Type::ProcessingInstruction: {
             
-            Handler(Document* document_) : document(document_), cur(nullptr) {}
+            auto& pi = static_cast<ProcessingInstruction&>(node);
+            return pi.getName().getLength() + pi.getValue().getLength() + 2;
             
-            void startDocument() { cur = document; }
-            void startElement(const char* name, std::size_t nameLength) {
-                
-                auto& element = document->createElement({name, nameLength});
-                cur->appendChild(element);
-                cur = &element;
-                
-            }
-            void endElement(const char* /*name*/, std::size_t /*nameLength*/) {
+        }
+        default: return 0;
+            
+        }
+        
+    }
+    static String copyString(String& str, char*& data) {
+        
+        auto copy = data;
+        std::memcpy(copy, str.getData(), str.getLength());
+        copy[str.getLength()] = 0;
+        data += str.getLength() + 1;
+        return {copy, str.getLength()};
+        
+    }
+    String copyName(String& name, char*& data) {
+        
+        auto copy = copyString(name, data);
+        return nameInterning ? intern(copy) : copy;
+        
+    }
+    // Copy a node without its children, taking the strings from data
+    Node& copyNode(Node& node, char*& data) {
+        
+        switch(node.getType()) {
+            
+        case Type::Element: {
+            
+            auto& element = static_cast<Element&>(node);
+            auto& copy = createElement(copyName(element.getName(), data));
+            for(auto& attr : element.attribute()) {
                 
-                cur = cur->parent;
+                auto name = copyName(attr.getName(), data);
+                copy.appendAttribute(createAttribute(name, copyString(attr.getValue(), data)));
                 
             }
-            void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            return copy;
+            
+        }
+        case Type::Text: return createText(copyString(static_cast<Text&>(node).getValue(), data));
+        case Type::CDATA: return createCDATA(copyString(static_cast<CDATA&>(node).getValue(), data));
+        case Type::Comment: return createComment(copyString(static_cast<Comment&>(node).getValue(), data));
+        case Type::ProcessingInstruction: {
+            
+            auto& pi = static_cast<ProcessingInstruction&>(node);
+            auto name = copyString(pi.getName(), data);
+            return createProcessingInstruction(name, copyString(pi.getValue(), data));
+            
+        }
+        default: throw std::invalid_argument("cannot copy a document");
+            
+        }
+        
+    }
+    // Copy node and its descendants, or only the descendants when node is a document, with all their strings
+    // packed in one block of the pool. The copies are appended to parent if it is not nullptr.
+    Node* copyTree(Node& node, Node* parent) {
+        
+        std::size_t size = 0;
+        Node* cur = &node;
+        while(true) {
+            
+            size += getStringSize(*cur);
+            if(cur->hasChildNodes()) { cur = &cur->getFirstChild(); continue; }
+            while(cur != &node && !cur->next) cur = cur->parent;
+            if(cur == &node) break;
+            cur = cur->next;
+            
+        }
+        auto data = static_cast<char*>(memoryPool.allocate(std::max<std::size_t>(size, 1)));
+        
+        Node* root = nullptr;
+        cur = &node;
+        if(node.getType() == Type::Document) {
+            
+            if(!node.hasChildNodes()) return nullptr;
+            cur = &node.getFirstChild();
+            
+        }
+        while(true) {
+            
+            auto& copy = copyNode(*cur, data);
+            if(parent) parent->appendChild(copy);
+            else root = &copy;
+            if(cur->hasChildNodes()) { parent = &copy; cur = &cur->getFirstChild(); continue; }
+            while(cur != &node && !cur->next) cur = cur->parent, parent = parent->parent;
+            if(cur == &node) break;
+            cur = cur->next;
+            
+        }
+        return root;
+        
+    }
+    void reserve(std::true_type) { memoryPool.reserve(reservation); }
+    void reserve(std::false_type) {}
+    std::size_t getMemorySize(std::true_type) const { return memoryPool.getSize(); }
+    std::size_t getMemorySize(std::false_type) const { return 0; }
+    
+    // Parse the content of a lazy element up to its end tag
+    template <Parser::Flag F>
+    static void expand(Element& element) {
+        
+        auto& deferred = *element.deferred;
+        element.deferred = nullptr;
+        auto document = static_cast<BasicDocument*>(deferred.document);
+        Parser parser;
+        if(F & Parser::Flag::InternalEntities) {
+            
+            // Expansions of lazy content count towards the limit of the whole document
+            parser.entities = document->parser.entities;
+            parser.maxEntityExpansion = document->parser.maxEntityExpansion;
+            parser.expansion = document->parser.expansion;
+            parser.inputSize = document->parser.inputSize;
+            
+        }
+        Handler handler(document, F & Parser::Flag::NonDestructive || F & Parser::Flag::InternalEntities ? &parser : nullptr, &expand<F>, deferred.base);
+        handler.setElement(&element);
+        parser.s = deferred.base;
+        parser.p = deferred.content;
+        // The content is followed by "</", which ends the last text
+        auto end = deferred.content + deferred.contentLength;
+        parser.e = end + 2;
+        parser.stack.push_back({element.getName().getData(), element.getName().getLength()});
+        parser.parseContent<F, true>(handler, end);
+        if(parser.p != end || parser.stack.size() != 1) throw Parser::Exception(parser.p - parser.s, "unexpected end");
+        document->parser.expansion = parser.expansion;
+        
+    }
+    
+public:
+    
+    BasicDocument() : DocumentBase(&memoryPool, &allocateFrom), memoryPool(), lazyDepth(0), reservation(0), parser(),
+        elementIndex(&memoryPool), valueIndex() {}
+    // Takes the allocator by value, an allocator that owns memory has to be moved in
+    explicit BasicDocument(A allocator) : DocumentBase(&memoryPool, &allocateFrom), memoryPool(std::move(allocator)),
+        lazyDepth(0), reservation(0), parser(), elementIndex(&memoryPool), valueIndex() {}
+    BasicDocument(const BasicDocument& src) = delete;
+    
+    A& getAllocator() { return memoryPool; }
+    
+    // A reused document can keep up to retention bytes of its pool across clear and parse, so that parsing
+    // inputs of similar sizes stops allocating. 0 frees the pool.
+    std::size_t getRetention() const { return memoryPool.getRetention(); }
+    void setRetention(std::size_t retention) { memoryPool.setRetention(retention); }
+    // Each parse starts with room for this many nodes and attributes and bytes of copied strings in one block
+    void reserve(std::size_t nodes, std::size_t bytes) { reservation = nodes * sizeof(Element) + bytes; }
+    std::size_t getMemoryCapacity() const { return memoryPool.getCapacity(); }
+    // Counts the nodes without expanding lazy content, memoryUsed is taken from getSize of the allocator or 0 without it
+    Statistics getStatistics() {
+        
+        Statistics statistics = {};
+        statistics.nodes[static_cast<std::size_t>(Type::Document)] = 1;
+        statistics.memoryUsed = getMemorySize(Impl::HasSize<A>());
+        Node* cur = this;
+        while(true) {
+            
+            bool expanded = cur->getType() != Type::Element || static_cast<Element*>(cur)->isExpanded();
+            if(expanded && cur->hasChildNodes()) {
                 
-                static_cast<Element*>(cur)->appendAttribute(document->createAttribute({name, nameLength}, {value, valueLength}));
+                cur = &cur->getFirstChild();
                 
-            }
-            void text(const char* value, std::size_t valueLength) {
+            } else {
                 
-                cur->appendChild(document->createText({value, valueLength}));
+                if(!expanded) ++statistics.deferred;
+                while(cur != this && !cur->next) cur = cur->parent;
+                if(cur == this) break;
+                cur = cur->next;
                 
             }
-            void cdata(const char* value, std::size_t valueLength) {
+            ++statistics.nodes[static_cast<std::size_t>(cur->getType())];
+            if(cur->getType() == Type::Element)
+                for(auto it = static_cast<Element*>(cur)->attribute().begin(); it != static_cast<Element*>(cur)->attribute().end(); ++it)
+                    ++statistics.attributes;
+            
+        }
+        return statistics;
+        
+    }
+    
+    // In lazy mode the content of elements lazyDepth levels down is skipped and kept as a span of the input,
+    // which is parsed the same way on the first access to the children. 0 parses everything at once.
+    std::size_t getLazyDepth() const { return lazyDepth; }
+    void setLazyDepth(std::size_t lazyDepth_) { lazyDepth = lazyDepth_; }
+    
+    // The elements are indexed on the first query, which expands a lazy document. The index is not updated when
+    // the tree is modified afterwards, until buildIndex is called again.
+    void buildIndex() {
+        
+        std::vector<Element*> elements;
+        Node* cur = this;
+        while(true) {
+            
+            if(cur->hasChildNodes()) {
                 
-                cur->appendChild(document->createCDATA({value, valueLength}));
+                cur = &cur->getFirstChild();
                 
-            }
-            void comment(const char* value, std::size_t valueLength) {
+            } else {
                 
-                cur->appendChild(document->createComment({value, valueLength}));
+                while(cur != this && !cur->next) cur = cur->parent;
+                if(cur == this) break;
+                cur = cur->next;
                 
             }
-            void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            if(cur->getType() == Type::Element) elements.push_back(static_cast<Element*>(cur));
+            
+        }
+        clearIndex();
+        elementIndex.build(elements, [](Element& element) { return &element.getName(); });
+        
+    }
+    void clearIndex() {
+        
+        elementIndex.clear();
+        valueIndex = nullptr;
+        
+    }
+    ElementList getElementsByTagName(String name) {
+        
+        if(!elementIndex.isBuilt()) buildIndex();
+        return elementIndex.get(name.getData(), name.getLength());
+        
+    }
+    // Elements whose first attribute with this name has this value, indexed for each name on the first query
+    ElementList getElementsByAttribute(String name, String value) {
+        
+        if(!elementIndex.isBuilt()) buildIndex();
+        auto index = valueIndex;
+        while(index && !(index->nameLength == name.getLength() && !std::memcmp(index->name, name.getData(), name.getLength())))
+            index = index->next;
+        if(!index) {
+            
+            auto copy = static_cast<char*>(memoryPool.allocate(std::max<std::size_t>(name.getLength(), 1)));
+            std::memcpy(copy, name.getData(), name.getLength());
+            name.set(copy, name.getLength());
+            index = new(memoryPool.allocate(sizeof(*index))) Impl::ValueIndex<A>(&memoryPool, copy, name.getLength(), valueIndex);
+            valueIndex = index;
+            auto all = elementIndex.getAll();
+            index->index.build(std::vector<Element*>(all.begin(), all.end()), [&name](Element& element) {
                 
-                cur->appendChild(document->createProcessingInstruction({name, nameLength}, {value, valueLength}));
+                auto attr = element.findAttribute(name);
+                return attr ? &attr->getValue() : nullptr;
                 
-            }
+            });
+            
+        }
+        return index->index.get(value.getData(), value.getLength());
+        
+    }
+    // Call match(element) for the elements selected by an element path in document order. The candidates are
+    // the elements with the first attribute value in the predicates of the last step, or else with its name.
+    template <typename M>
+    void select(const Query& query, M match) {
+        
+        if(query.getTarget() != Query::Target::Element) throw Query::Exception(0, "expected element path");
+        if(!elementIndex.isBuilt()) buildIndex();
+        auto& last = query.steps.back();
+        ElementList candidates = last.any ? elementIndex.getAll() : elementIndex.get(last.name.data(), last.name.size());
+        for(std::size_t j = 0; j < query.predicates.size(); ++j) {
             
-        };
+            auto& predicate = query.predicates[j];
+            if(!(last.predicates & (std::uint64_t(1) << j)) || !predicate.hasValue) continue;
+            candidates = getElementsByAttribute({predicate.name.data(), predicate.name.size()}, {predicate.value.data(), predicate.value.size()});
+            break;
+            
+        }
+        std::vector<Element*> path;
+        for(auto element : candidates) if(selects(query, *element, path)) match(*element);
+        
+    }
+    
+    Element& createElement(const String& name) {
+        
+        return *new(memoryPool.allocate(sizeof(Element))) Element(name);
+        
+    }
+    Attribute& createAttribute(const String& name, const String& value) {
+        
+        return *new(memoryPool.allocate(sizeof(Attribute))) Attribute(name, value);
+        
+    }
+    Text& createText(const String& value) {
+        
+        return *new(memoryPool.allocate(sizeof(Text))) Text(value);
+        
+    }
+    CDATA& createCDATA(const String& value) {
+        
+        return *new(memoryPool.allocate(sizeof(CDATA))) CDATA(value);
+        
+    }
+    Comment& createComment(const String& value) {
+        
+        return *new(memoryPool.allocate(sizeof(Comment))) Comment(value);
+        
+    }
+    ProcessingInstruction& createProcessingInstruction(const String& name, const String& value) {
+        
+        return *new(memoryPool.allocate(sizeof(ProcessingInstruction))) ProcessingInstruction(name, value);
+        
+    }
+    
+    // Copy node and its descendants from any document into this one, with all the strings they reference packed
+    // in one block of the pool, so that the copy no longer depends on the input or the document of node. Lazy
+    // content is expanded first. The copy is not linked into the tree.
+    Node& importNode(Node& node) {
+        
+        if(node.getType() == Type::Document) throw std::invalid_argument("cannot import a document");
+        return *copyTree(node, nullptr);
+        
+    }
+    // Replace the content with a copy of document made as by importNode
+    template <typename B>
+    void clone(BasicDocument<B>& document) {
+        
+        if(static_cast<Node*>(&document) == this) return;
+        clear();
+        copyTree(document, this);
+        
+    }
+    
+    void clear() {
+        
+        clearChildren();
+        memoryPool.clear();
+        names.clear();
+        clearIndex();
+        
+    }
+    
+    template <Parser::Flag F>
+    void parse(char* data) {
         
         assert(data);
         
         clear();
-        Parser parser;
-        Handler handler(this);
+        if(reservation) reserve(Impl::HasReserve<A>());
+        Handler handler(this, F & Parser::Flag::InternalEntities ? &parser : nullptr, &expand<F>, data);
         parser.parse<F>(data, handler);
         
+    }
+    // The nodes point into data, which must outlive the document
+    template <Parser::Flag F>
+    void parse(const char* data, std::size_t size) {
+        
+        assert(data || !size);
+        
+        clear();
+        if(reservation) reserve(Impl::HasReserve<A>());
+        Handler handler(this, &parser, &expand<F>, const_cast<char*>(data));
+        parser.parse<F>(data, size, handler);
+        
+    }
+    // As parse, returning a malformed input as by Parser::tryParse. The document then holds the nodes before the error.
+    template <Parser::Flag F>
+    Parser::Result tryParse(char* data) {
+        
+        assert(data);
+        
+        clear();
+        if(reservation) reserve(Impl::HasReserve<A>());
+        Handler handler(this, F & Parser::Flag::InternalEntities ? &parser : nullptr, &expand<F>, data);
+        return parser.tryParse<F>(data, handler);
+        
+    }
+    template <Parser::Flag F>
+    Parser::Result tryParse(const char* data, std::size_t size) {
+        
+        assert(data || !size);
+        
+        clear();
+        if(reservation) reserve(Impl::HasReserve<A>());
+        Handler handler(this, &parser, &expand<F>, const_cast<char*>(data));
+        return parser.tryParse<F>(data, size, handler);
+        
     }
     
-    void serialize(Corecat::Stream::Base& stream) {
+    template <typename W>
+    void serialize(BasicSerializer<W>& serializer) {
         
-        Serializer serializer(stream);
         serializer.startDocument();
         if(hasChildNodes()) {
             
@@ -509,10 +1347,81 @@ public:
         serializer.endDocument();
         
     }
+    void serialize(Corecat::Stream::Base& stream, SerializerBase::Flag flag = SerializerBase::Flag::Default) {
+        
+        BufferedSerializer serializer(stream, flag);
+        serialize(serializer);
+        
+    }
+    void serialize(std::string& str, SerializerBase::Flag flag = SerializerBase::Flag::Default) {
+        
+        StringSerializer serializer(str, flag);
+        serialize(serializer);
+        
+    }
+    void serialize(std::vector<char>& data, SerializerBase::Flag flag = SerializerBase::Flag::Default) {
+        
+        BasicSerializer<ContainerWriter<std::vector<char>>> serializer(data, flag);
+        serialize(serializer);
+        
+    }
     
 };
 
-inline std::ostream& operator <<(std::ostream& stream, Document& document) {
+using Document = BasicDocument<Arena>;
+
+inline Attribute* Element::findAttribute(const String& name_) {
+    
+    String key = name_;
+    auto data = key.getData();
+    auto length = key.getLength();
+    auto equal = [](Attribute& attr, const char* d, std::size_t l) {
+        
+        auto& attrName = attr.getName();
+        return attrName.getLength() == l && (attrName.getData() == d || !std::memcmp(attrName.getData(), d, l));
+        
+    };
+    
+    if(!index) {
+        
+        std::size_t count = 0;
+        for(auto it = listAttr.begin(); it != listAttr.end() && count <= INDEX_THRESHOLD; ++it) ++count;
+        Impl::DocumentBase* document = nullptr;
+        if(count > INDEX_THRESHOLD) {
+            
+            // The pool of the document is only needed to build the index
+            Node* root = this;
+            while(root->parent) root = root->parent;
+            if(root->getType() == Type::Document) document = static_cast<Impl::DocumentBase*>(root);
+            
+        }
+        if(!document) {
+            
+            for(auto& attr : listAttr) if(equal(attr, data, length)) return &attr;
+            return nullptr;
+            
+        }
+        count = 0;
+        for(auto it = listAttr.begin(); it != listAttr.end(); ++it) ++count;
+        index = new(document->allocate(sizeof(Impl::AttributeIndex))) Impl::AttributeIndex(document);
+        index->reserve(count);
+        for(auto& attr : listAttr) {
+            
+            // Keep the first of duplicate names, as the linear search does
+            auto slot = index->insert(attr.getName().getData(), attr.getName().getLength());
+            if(!slot->attribute) slot->attribute = &attr;
+            
+        }
+        
+    }
+    
+    auto slot = index->lookup(data, length);
+    return slot ? slot->attribute : nullptr;
+    
+}
+
+template <typename A>
+inline std::ostream& operator <<(std::ostream& stream, BasicDocument<A>& document) {
     
     auto wrapper = Corecat::Stream::createWrapper(stream);
     document.serialize(wrapper);
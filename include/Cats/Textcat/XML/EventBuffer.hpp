@@ -0,0 +1,271 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_EVENTBUFFER_HPP
+#define CATS_TEXTCAT_XML_EVENTBUFFER_HPP
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+
+#include "Handler.hpp"
+#include "Parser.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Records handler events to replay them later, possibly on another thread. Strings point into the parsed
+// buffer, except values translated by a NonDestructive parser, which are copied into the event buffer.
+class EventBuffer {
+    
+public:
+    
+    enum class Event : std::uint8_t {
+        
+        StartDocument,
+        EndDocument,
+        StartElement,
+        EndElement,
+        EndAttributes,
+        Doctype,
+        Attribute,
+        Text,
+        CDATA,
+        Comment,
+        ProcessingInstruction,
+        
+    };
+    
+    class Recorder : public HandlerBase {
+        
+    private:
+        
+        EventBuffer* buffer;
+        const Parser* parser;
+        
+    private:
+        
+        bool isBuffered(const char* data, std::size_t length) const { return parser && length && parser->isBuffered(data); }
+        
+    public:
+        
+        Recorder(EventBuffer* buffer_, const Parser* parser_) : buffer(buffer_), parser(parser_) {}
+        
+        void startDocument() { buffer->writeEvent(Event::StartDocument); }
+        void endDocument() { buffer->writeEvent(Event::EndDocument); }
+        void startElement(const char* name, std::size_t nameLength) {
+            
+            buffer->writeEvent(Event::StartElement);
+            buffer->writeString(name, nameLength);
+            
+        }
+        void endElement(const char* name, std::size_t nameLength) {
+            
+            buffer->writeEvent(Event::EndElement);
+            buffer->writeString(name, nameLength);
+            
+        }
+        void endAttributes() { buffer->writeEvent(Event::EndAttributes); }
+        void doctype(const char* name, std::size_t nameLength, const char* publicId, std::size_t publicIdLength,
+            const char* systemId, std::size_t systemIdLength, const char* internalSubset, std::size_t internalSubsetLength) {
+            
+            buffer->writeEvent(Event::Doctype);
+            buffer->writeString(name, nameLength);
+            buffer->writeString(publicId, publicIdLength);
+            buffer->writeString(systemId, systemIdLength);
+            buffer->writeString(internalSubset, internalSubsetLength);
+            
+        }
+        void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            bool copy = isBuffered(value, valueLength);
+            buffer->writeEvent(Event::Attribute, copy);
+            buffer->writeString(name, nameLength);
+            buffer->writeString(value, valueLength, copy);
+            
+        }
+        void text(const char* value, std::size_t valueLength) {
+            
+            bool copy = isBuffered(value, valueLength);
+            buffer->writeEvent(Event::Text, copy);
+            buffer->writeString(value, valueLength, copy);
+            
+        }
+        void cdata(const char* value, std::size_t valueLength) {
+            
+            buffer->writeEvent(Event::CDATA);
+            buffer->writeString(value, valueLength);
+            
+        }
+        void comment(const char* value, std::size_t valueLength) {
+            
+            buffer->writeEvent(Event::Comment);
+            buffer->writeString(value, valueLength);
+            
+        }
+        void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            buffer->writeEvent(Event::ProcessingInstruction);
+            buffer->writeString(name, nameLength);
+            buffer->writeString(value, valueLength);
+            
+        }
+        
+    };
+    
+private:
+    
+    // Events are packed as a tag byte followed by their strings, each either a pointer and a length or, for
+    // copied values, a length and the bytes themselves
+    std::unique_ptr<char[]> storage;
+    std::size_t capacity;
+    std::size_t used;
+    std::size_t count;
+    
+private:
+    
+    void grow(std::size_t size) {
+        
+        std::unique_ptr<char[]> t(new char[size]);
+        if(used) std::memcpy(t.get(), storage.get(), used);
+        storage = std::move(t);
+        capacity = size;
+        
+    }
+    void write(const void* data, std::size_t length) {
+        
+        if(capacity - used < length) grow(std::max<std::size_t>(std::max<std::size_t>(capacity * 2, used + length), 4096));
+        std::memcpy(storage.get() + used, data, length);
+        used += length;
+        
+    }
+    void writeEvent(Event event, bool copy = false) {
+        
+        unsigned char tag = static_cast<unsigned char>(static_cast<unsigned char>(event) | (copy ? 0x80 : 0));
+        write(&tag, 1);
+        ++count;
+        
+    }
+    void writeString(const char* data, std::size_t length, bool copy = false) {
+        
+        if(!copy) write(&data, sizeof(data));
+        write(&length, sizeof(length));
+        if(copy) write(data, length);
+        
+    }
+    static void readString(const char*& q, const char*& data, std::size_t& length, bool copy = false) {
+        
+        if(!copy) { std::memcpy(&data, q, sizeof(data)); q += sizeof(data); }
+        std::memcpy(&length, q, sizeof(length));
+        q += sizeof(length);
+        if(copy) { data = q; q += length; }
+        
+    }
+    
+public:
+    
+    EventBuffer() : storage(), capacity(), used(), count() {}
+    EventBuffer(const EventBuffer& src) = delete;
+    
+    void clear() { used = 0; count = 0; }
+    bool empty() const { return !count; }
+    std::size_t size() const { return count; }
+    
+    // Reserves bytes of packed events, which take 17 bytes per name or value. The storage is not initialized,
+    // so a generous guess costs little more than address space.
+    void reserve(std::size_t size) { if(capacity < size) grow(size); }
+    
+    template <typename H>
+    void replay(H& handler) const {
+        
+        const char* data1;
+        const char* data2;
+        std::size_t length1;
+        std::size_t length2;
+        for(const char* q = storage.get(), * end = q + used; q != end; ) {
+            
+            unsigned char tag = static_cast<unsigned char>(*q++);
+            bool copy = tag & 0x80;
+            switch(static_cast<Event>(tag & 0x7F)) {
+                
+            case Event::StartDocument: handler.startDocument(); break;
+            case Event::EndDocument: handler.endDocument(); break;
+            case Event::StartElement: readString(q, data1, length1); handler.startElement(data1, length1); break;
+            case Event::EndElement: readString(q, data1, length1); handler.endElement(data1, length1); break;
+            case Event::EndAttributes: handler.endAttributes(); break;
+            case Event::Doctype: {
+                
+                const char* data3;
+                const char* data4;
+                std::size_t length3;
+                std::size_t length4;
+                readString(q, data1, length1);
+                readString(q, data2, length2);
+                readString(q, data3, length3);
+                readString(q, data4, length4);
+                handler.doctype(data1, length1, data2, length2, data3, length3, data4, length4);
+                break;
+                
+            }
+            case Event::Attribute: {
+                
+                readString(q, data1, length1);
+                readString(q, data2, length2, copy);
+                handler.attribute(data1, length1, data2, length2);
+                break;
+                
+            }
+            case Event::Text: readString(q, data1, length1, copy); handler.text(data1, length1); break;
+            case Event::CDATA: readString(q, data1, length1); handler.cdata(data1, length1); break;
+            case Event::Comment: readString(q, data1, length1); handler.comment(data1, length1); break;
+            case Event::ProcessingInstruction: {
+                
+                readString(q, data1, length1);
+                readString(q, data2, length2);
+                handler.processingInstruction(data1, length1, data2, length2);
+                break;
+                
+            }
+            
+            }
+            
+        }
+        
+    }
+    
+};
+
+}
+}
+}
+
+
+#endif
@@ -28,10 +28,53 @@
 #define CATS_TEXTCAT_XML_HANDLER_HPP
 
 
+#include <cstddef>
+#include <cstdint>
+
+#include <type_traits>
+#include <utility>
+
+
 namespace Cats {
 namespace Textcat{
 namespace XML {
 
+// Returned from startElement or endAttributes to parse the content of the element (Continue), to skip it
+// (Skip) or to end parsing without further callbacks (Stop). A skipped content is reported through skipped and
+// is followed by endElement, and skipping from startElement also skips the attributes.
+enum class Directive {
+    
+    Continue,
+    Skip,
+    Stop,
+    
+};
+
+// Callbacks whose events the parser can skip over. A handler may declare the ones it uses as
+// static constexpr Callback CALLBACKS, otherwise a callback it inherits from HandlerBase is ignored.
+enum class Callback : std::uint32_t {
+    
+    None = 0x00000000,
+    Attribute = 0x00000001,
+    Text = 0x00000002,
+    CDATA = 0x00000004,
+    Comment = 0x00000008,
+    ProcessingInstruction = 0x00000010,
+    
+    All = Attribute | Text | CDATA | Comment | ProcessingInstruction,
+    
+};
+constexpr bool operator &(Callback a, Callback b) {
+    
+    return static_cast<std::uint32_t>(a) & static_cast<std::uint32_t>(b);
+    
+}
+constexpr Callback operator |(Callback a, Callback b) {
+    
+    return static_cast<Callback>(static_cast<std::uint32_t>(a) | static_cast<std::uint32_t>(b));
+    
+}
+
 class HandlerBase {
     
 public:
@@ -41,7 +84,9 @@ public:
     void startElement(const char* /*name*/, std::size_t /*nameLength*/) {}
     void endElement(const char* /*name*/, std::size_t /*nameLength*/) {}
     void endAttributes() {}
-    void doctype() {}
+    void skipped(const char* /*content*/, std::size_t /*contentLength*/) {}
+    void doctype(const char* /*name*/, std::size_t /*nameLength*/, const char* /*publicId*/, std::size_t /*publicIdLength*/,
+        const char* /*systemId*/, std::size_t /*systemIdLength*/, const char* /*internalSubset*/, std::size_t /*internalSubsetLength*/) {}
     void attribute(const char* /*name*/, std::size_t /*nameLength*/, const char* /*value*/, std::size_t /*valueLength*/) {}
     void text(const char* /*value*/, std::size_t /*valueLength*/) {}
     void cdata(const char* /*value*/, std::size_t /*valueLength*/) {}
@@ -50,6 +95,79 @@ public:
     
 };
 
+namespace Impl {
+
+// Handlers may return void from startElement and endAttributes, which means Directive::Continue
+template <typename H>
+inline Directive startElement(H& handler, const char* name, std::size_t nameLength, std::true_type) {
+    
+    handler.startElement(name, nameLength);
+    return Directive::Continue;
+    
+}
+template <typename H>
+inline Directive startElement(H& handler, const char* name, std::size_t nameLength, std::false_type) {
+    
+    return handler.startElement(name, nameLength);
+    
+}
+template <typename H>
+inline Directive startElement(H& handler, const char* name, std::size_t nameLength) {
+    
+    return startElement(handler, name, nameLength, std::is_void<decltype(handler.startElement(name, nameLength))>());
+    
+}
+template <typename H>
+inline Directive endAttributes(H& handler, std::true_type) { handler.endAttributes(); return Directive::Continue; }
+template <typename H>
+inline Directive endAttributes(H& handler, std::false_type) { return handler.endAttributes(); }
+template <typename H>
+inline Directive endAttributes(H& handler) {
+    
+    return endAttributes(handler, std::is_void<decltype(handler.endAttributes())>());
+    
+}
+
+// A callback is used unless the handler inherits it from HandlerBase, overloaded callbacks are used
+template <typename H, typename = void>
+struct UsesAttribute : std::true_type {};
+template <typename H>
+struct UsesAttribute<H, typename std::enable_if<std::is_same<decltype(&H::attribute), decltype(&HandlerBase::attribute)>::value>::type> : std::false_type {};
+template <typename H, typename = void>
+struct UsesText : std::true_type {};
+template <typename H>
+struct UsesText<H, typename std::enable_if<std::is_same<decltype(&H::text), decltype(&HandlerBase::text)>::value>::type> : std::false_type {};
+template <typename H, typename = void>
+struct UsesCDATA : std::true_type {};
+template <typename H>
+struct UsesCDATA<H, typename std::enable_if<std::is_same<decltype(&H::cdata), decltype(&HandlerBase::cdata)>::value>::type> : std::false_type {};
+template <typename H, typename = void>
+struct UsesComment : std::true_type {};
+template <typename H>
+struct UsesComment<H, typename std::enable_if<std::is_same<decltype(&H::comment), decltype(&HandlerBase::comment)>::value>::type> : std::false_type {};
+template <typename H, typename = void>
+struct UsesProcessingInstruction : std::true_type {};
+template <typename H>
+struct UsesProcessingInstruction<H, typename std::enable_if<std::is_same<decltype(&H::processingInstruction), decltype(&HandlerBase::processingInstruction)>::value>::type> : std::false_type {};
+
+template <typename H, typename = void>
+struct Callbacks : std::integral_constant<Callback,
+    (UsesAttribute<H>::value ? Callback::Attribute : Callback::None) |
+    (UsesText<H>::value ? Callback::Text : Callback::None) |
+    (UsesCDATA<H>::value ? Callback::CDATA : Callback::None) |
+    (UsesComment<H>::value ? Callback::Comment : Callback::None) |
+    (UsesProcessingInstruction<H>::value ? Callback::ProcessingInstruction : Callback::None)> {};
+template <typename H>
+struct Callbacks<H, typename std::enable_if<std::is_same<decltype(H::CALLBACKS), const Callback>::value>::type> :
+    std::integral_constant<Callback, H::CALLBACKS> {};
+    
+template <typename H>
+struct HasDirective : std::integral_constant<bool,
+    !std::is_void<decltype(std::declval<H&>().startElement(nullptr, 0))>::value ||
+    !std::is_void<decltype(std::declval<H&>().endAttributes())>::value> {};
+    
+}
+
 }
 }
 }
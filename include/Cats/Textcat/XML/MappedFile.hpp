@@ -0,0 +1,235 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_MAPPEDFILE_HPP
+#define CATS_TEXTCAT_XML_MAPPEDFILE_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// A file mapped into memory. A ReadOnly mapping is parsed by the NonDestructive parse of data and size. A
+// Private mapping is a copy-on-write view followed by a NUL, parsed in situ without changing the file.
+class MappedFile {
+    
+public:
+    
+    enum class Mode {
+        
+        ReadOnly,
+        Private,
+        
+    };
+    
+    // Hints to the kernel, ignored where unsupported
+    enum class Hint : std::uint32_t {
+        
+        None = 0x00000000,
+        Sequential = 0x00000001,
+        WillNeed = 0x00000002,
+        HugePage = 0x00000004,
+        
+        Default = Sequential | HugePage,
+        
+    };
+    friend constexpr bool operator &(Hint a, Hint b) {
+        
+        return static_cast<std::uint32_t>(a) & static_cast<std::uint32_t>(b);
+        
+    }
+    friend constexpr Hint operator |(Hint a, Hint b) {
+        
+        return static_cast<Hint>(static_cast<std::uint32_t>(a) | static_cast<std::uint32_t>(b));
+        
+    }
+    
+private:
+    
+    char* data;
+    std::size_t size;
+    // Bytes mapped or allocated at data
+    std::size_t length;
+    // Read into memory instead of mapped
+    bool allocated;
+    
+private:
+    
+#if defined(_WIN32)
+    void map(const char* name, Mode mode, Hint hint) {
+        
+        auto file = ::CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            hint & Hint::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) throw std::runtime_error("can't open file");
+        LARGE_INTEGER fileSize;
+        if(!::GetFileSizeEx(file, &fileSize)) { ::CloseHandle(file); throw std::runtime_error("can't read file"); }
+        size = static_cast<std::size_t>(fileSize.QuadPart);
+        SYSTEM_INFO info;
+        ::GetSystemInfo(&info);
+        if(mode == Mode::Private && size % info.dwPageSize == 0) {
+            
+            // No zero-filled tail in the last page to end the view, read a copy instead
+            length = size + 1;
+            data = static_cast<char*>(::VirtualAlloc(nullptr, length, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+            allocated = true;
+            std::size_t count = 0;
+            while(data && count < size) {
+                
+                DWORD n = 0;
+                auto chunk = static_cast<DWORD>(std::min<std::size_t>(size - count, 1 << 30));
+                if(!::ReadFile(file, data + count, chunk, &n, nullptr) || !n) break;
+                count += n;
+                
+            }
+            ::CloseHandle(file);
+            if(!data) throw std::bad_alloc();
+            if(count < size) { close(); throw std::runtime_error("can't read file"); }
+            return;
+            
+        }
+        if(size) {
+            
+            auto mapping = ::CreateFileMappingA(file, nullptr, mode == Mode::Private ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+            if(mapping) {
+                
+                data = static_cast<char*>(::MapViewOfFile(mapping, mode == Mode::Private ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+                ::CloseHandle(mapping);
+                
+            }
+            ::CloseHandle(file);
+            if(!data) throw std::runtime_error("can't map file");
+            length = size;
+            
+        } else ::CloseHandle(file);
+        
+    }
+    void unmap() {
+        
+        if(allocated) ::VirtualFree(data, 0, MEM_RELEASE);
+        else if(data) ::UnmapViewOfFile(data);
+        allocated = false;
+        
+    }
+#else
+    void map(const char* name, Mode mode, Hint hint) {
+        
+        int fd = ::open(name, O_RDONLY);
+        if(fd < 0) throw std::runtime_error("can't open file");
+        struct stat st;
+        if(::fstat(fd, &st)) { ::close(fd); throw std::runtime_error("can't read file"); }
+        size = static_cast<std::size_t>(st.st_size);
+        void* p = MAP_FAILED;
+        if(mode == Mode::Private) {
+            
+            // The file is mapped over zeroed pages that provide the NUL even when it fills its last page
+            length = size + 1;
+            p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p != MAP_FAILED && size && ::mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                
+                ::munmap(p, length);
+                p = MAP_FAILED;
+                
+            }
+            
+        } else if(size) {
+            
+            length = size;
+            p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            
+        }
+        ::close(fd);
+        if(!length) return;
+        if(p == MAP_FAILED) { length = 0; throw std::runtime_error("can't map file"); }
+        data = static_cast<char*>(p);
+        if(!size) return;
+        if(hint & Hint::Sequential) ::madvise(p, size, MADV_SEQUENTIAL);
+        if(hint & Hint::WillNeed) ::madvise(p, size, MADV_WILLNEED);
+#if defined(MADV_HUGEPAGE)
+        if(hint & Hint::HugePage) ::madvise(p, size, MADV_HUGEPAGE);
+#endif
+        
+    }
+    void unmap() { if(data) ::munmap(data, length); }
+#endif
+    
+public:
+    
+    MappedFile() : data(), size(), length(), allocated() {}
+    MappedFile(const char* name, Mode mode = Mode::ReadOnly, Hint hint = Hint::Default) : MappedFile() { open(name, mode, hint); }
+    MappedFile(const MappedFile& src) = delete;
+    ~MappedFile() { close(); }
+    
+    MappedFile& operator =(const MappedFile& src) = delete;
+    
+    void open(const char* name, Mode mode = Mode::ReadOnly, Hint hint = Hint::Default) {
+        
+        close();
+        map(name, mode, hint);
+        
+    }
+    void close() {
+        
+        unmap();
+        data = nullptr;
+        size = 0;
+        length = 0;
+        
+    }
+    
+    // Null for an empty ReadOnly file
+    char* getData() { return data; }
+    const char* getData() const { return data; }
+    // Without the NUL of a Private mapping
+    std::size_t getSize() const { return size; }
+    
+};
+
+}
+}
+}
+
+
+#endif
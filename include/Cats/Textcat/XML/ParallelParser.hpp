@@ -0,0 +1,250 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_PARALLELPARSER_HPP
+#define CATS_TEXTCAT_XML_PARALLELPARSER_HPP
+
+
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "EventBuffer.hpp"
+#include "Parser.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Parses record lists like <list><row/>...<row/></list> on several threads. The content of the root is split
+// before start tags named like its first child, each chunk but the first is parsed into an EventBuffer by a
+// worker, and the events are replayed in document order. A split that does not fall between two children of
+// the root is detected when the chunk before it does not end there, and the rest is then parsed sequentially.
+class ParallelParser {
+    
+private:
+    
+    std::size_t threadCount;
+    std::size_t minChunkSize;
+    std::size_t maxDepth;
+    std::size_t maxEntityExpansion;
+    
+private:
+    
+    static bool isDelimiter(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '/' || c == '>'; }
+    
+    // Name of the first element starting in [p, e), or an empty name
+    static const char* findChild(const char* p, const char* e, std::size_t& nameLength) {
+        
+        for(; (p = static_cast<const char*>(std::memchr(p, '<', e - p))); ++p) {
+            
+            if(e - p < 2 || p[1] == '/' || p[1] == '!' || p[1] == '?') continue;
+            auto q = ++p;
+            while(q != e && !isDelimiter(*q)) ++q;
+            nameLength = q - p;
+            return p;
+            
+        }
+        nameLength = 0;
+        return nullptr;
+        
+    }
+    // First start tag of the named element in [p, e), or e
+    static const char* findElement(const char* p, const char* e, const char* name, std::size_t nameLength) {
+        
+        for(; (p = static_cast<const char*>(std::memchr(p, '<', e - p))); ++p) {
+            
+            if(static_cast<std::size_t>(e - p) > nameLength + 1 && !std::memcmp(p + 1, name, nameLength) && isDelimiter(p[nameLength + 1]))
+                return p;
+            
+        }
+        return e;
+        
+    }
+    
+public:
+    
+    static constexpr std::size_t DEFAULT_MIN_CHUNK_SIZE = 1 << 20;
+    
+    ParallelParser() : threadCount(std::max<std::size_t>(std::thread::hardware_concurrency(), 1)),
+        minChunkSize(DEFAULT_MIN_CHUNK_SIZE), maxDepth(std::numeric_limits<std::size_t>::max()),
+        maxEntityExpansion() {}
+    ParallelParser(const ParallelParser& src) = delete;
+    
+    std::size_t getThreadCount() const { return threadCount; }
+    void setThreadCount(std::size_t threadCount_) { threadCount = std::max<std::size_t>(threadCount_, 1); }
+    std::size_t getMinChunkSize() const { return minChunkSize; }
+    void setMinChunkSize(std::size_t minChunkSize_) { minChunkSize = std::max<std::size_t>(minChunkSize_, 1); }
+    std::size_t getMaxDepth() const { return maxDepth; }
+    void setMaxDepth(std::size_t maxDepth_) { maxDepth = maxDepth_; }
+    // The limit of Parser for the whole document, 0 is the default of Parser
+    std::size_t getMaxEntityExpansion() const { return maxEntityExpansion; }
+    void setMaxEntityExpansion(std::size_t maxEntityExpansion_) { maxEntityExpansion = maxEntityExpansion_; }
+    
+    template <Parser::Flag F, typename H>
+    void parse(const char* data, std::size_t size, H& handler) {
+        
+        static_assert(F & Parser::Flag::NonDestructive, "Parsing bounded input without Flag::NonDestructive");
+        
+        Parser parser;
+        parser.setMaxDepth(maxDepth);
+        parser.setMaxEntityExpansion(maxEntityExpansion);
+        // Directives depend on the events before them, so such handlers are run on this thread
+        if(Impl::HasDirective<H>::value) { parser.parse<F>(data, size, handler); return; }
+        parser.s = const_cast<char*>(data);
+        parser.p = parser.s;
+        parser.e = parser.s + size;
+        // Parse up to the content of the root on this thread
+        parser.parseProlog<F>(handler);
+        if(!parser.parseTopLevel<F, true>(handler)) { handler.endDocument(); return; }
+        char* name;
+        std::size_t nameLength;
+        if(parser.parseStartTag<F>(handler, name, nameLength)) {
+            
+            handler.endElement(name, nameLength);
+            parser.parseTopLevel<F, false>(handler);
+            handler.endDocument();
+            return;
+            
+        }
+        parser.stack.clear();
+        parser.stack.push_back({name, nameLength});
+        
+        std::vector<const char*> splits(1, parser.p);
+        const char* end = parser.e;
+        std::size_t count = std::min(threadCount, static_cast<std::size_t>(end - parser.p) / minChunkSize);
+        std::size_t recordLength;
+        auto record = count > 1 ? findChild(parser.p, end, recordLength) : nullptr;
+        if(record && recordLength) {
+            
+            for(std::size_t i = 1; i < count; ++i) {
+                
+                auto target = std::max(splits[0] + (end - splits[0]) / count * i, splits.back() + 1);
+                auto split = findElement(target, end, record, recordLength);
+                if(split == end) break;
+                splits.push_back(split);
+                
+            }
+            
+        }
+        if(splits.size() == 1) {
+            
+            parser.parseContent<F, false>(handler, nullptr);
+            parser.parseTopLevel<F, false>(handler);
+            handler.endDocument();
+            return;
+            
+        }
+        
+        auto n = splits.size();
+        std::unique_ptr<EventBuffer[]> events(new EventBuffer[n]);
+        std::unique_ptr<bool[]> valid(new bool[n]());
+        std::unique_ptr<std::size_t[]> expansions(new std::size_t[n]());
+        // The workers split what the prolog left of the limit, so that the buffered replacements stay within it
+        auto limit = maxEntityExpansion ? maxEntityExpansion :
+            std::max(size * Parser::DEFAULT_ENTITY_EXPANSION_FACTOR, std::size_t(Parser::MIN_ENTITY_EXPANSION));
+        auto share = std::max<std::size_t>((limit - std::min(limit, parser.expansion)) / n, 1);
+        parser.setMaxEntityExpansion(limit);
+        std::vector<std::thread> threads;
+        struct Join {
+            
+            std::vector<std::thread>& threads;
+            ~Join() { for(auto& thread : threads) if(thread.joinable()) thread.join(); }
+            
+        } join{threads};
+        auto root = parser.stack.front();
+        for(std::size_t i = 1; i < n; ++i) {
+            
+            threads.emplace_back([&, i] {
+                
+                // Packed events are usually two to three times the size of the input
+                events[i].reserve(((i + 1 < n ? splits[i + 1] : end) - splits[i]) * 3);
+                Parser worker;
+                worker.setMaxDepth(maxDepth);
+                worker.setMaxEntityExpansion(share);
+                worker.s = const_cast<char*>(data);
+                worker.p = const_cast<char*>(splits[i]);
+                worker.e = worker.s + size;
+                worker.stack.push_back(root);
+                worker.entities = parser.entities;
+                EventBuffer::Recorder recorder(&events[i], &worker);
+                try {
+                    
+                    if(i + 1 < n) {
+                        
+                        worker.parseContent<F, true>(recorder, splits[i + 1]);
+                        valid[i] = worker.p == splits[i + 1] && worker.stack.size() == 1;
+                        expansions[i] = worker.expansion;
+                        
+                    } else {
+                        
+                        worker.parseContent<F, false>(recorder, nullptr);
+                        worker.parseTopLevel<F, false>(recorder);
+                        recorder.endDocument();
+                        valid[i] = true;
+                        expansions[i] = worker.expansion;
+                        
+                    }
+                    
+                } catch(...) {}
+                
+            });
+            
+        }
+        
+        // Replay the chunks after the first as long as each one starts where the previous ended, and parse a chunk
+        // again when it would pass the limit, so that it fails where Parser does
+        parser.parseContent<F, true>(handler, splits[1]);
+        for(std::size_t i = 1; i < n; ++i) {
+            
+            threads[i - 1].join();
+            if(parser.p != splits[i] || parser.stack.size() != 1 || !valid[i]) break;
+            if(expansions[i] > limit - parser.expansion) break;
+            parser.expansion += expansions[i];
+            events[i].replay(handler);
+            if(i + 1 == n) return;
+            parser.p = const_cast<char*>(splits[i + 1]);
+            
+        }
+        parser.parseContent<F, false>(handler, nullptr);
+        parser.parseTopLevel<F, false>(handler);
+        handler.endDocument();
+        
+    }
+    
+};
+
+}
+}
+}
+
+
+#endif
@@ -30,13 +30,21 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 
 #include <algorithm>
 #include <exception>
 #include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "Cats/Corecat/Sequence.hpp"
 
+#include "Handler.hpp"
+#include "Skipper.hpp"
+#include "StructuralIndex.hpp"
+
 
 namespace Cats {
 namespace Textcat{
@@ -44,45 +52,11 @@ namespace XML {
 
 namespace Impl {
 
-template <typename T, T... V>
-struct Include {
-    
-    static constexpr bool get(T t) { return Corecat::Sequence::Contain<Corecat::Sequence::Base<T, V...>>::get(t); }
-    
-};
-
-template <typename T, T... V>
-struct Exclude {
-    
-    static constexpr bool get(T t) { return !Corecat::Sequence::Contain<Corecat::Sequence::Base<T, V...>>::get(t); }
-    
-};
-
-
-template <typename Cond, typename = void>
-struct Skipper {
-    
-    static size_t skip(char*& p) {
-        
-        using namespace Corecat::Sequence;
-        
-        auto t = p;
-        while(Table<Mapper<Cond, Index<unsigned char, 0, 255>>>::get(*t)) {
-            
-            ++t;
-            
-        }
-        const size_t length = t - p;
-        p = t;
-        return length;
-        
-    }
-    
-};
-
-
 using Space = Include<unsigned char, '\t', '\n', '\r', ' '>;
 using Name = Exclude<unsigned char, 0, '\t', '\n', '\r', ' ', '/', '>', '?'>;
+using DoctypeName = Exclude<unsigned char, 0, '\t', '\n', '\r', ' ', '>', '['>;
+using EntityName = Exclude<unsigned char, 0, '\t', '\n', '\r', ' ', '"', '&', '\'', ';', '<', '>'>;
+using InternalSubset = Exclude<unsigned char, 0, '"', '\'', '<', ']'>;
 using AttributeName = Exclude<unsigned char, 0, '\t', '\n', '\r', ' ', '!', '/', '<', '=', '>', '?'>;
 using AttributeValue1 = Exclude<unsigned char, 0, '"'>;
 using AttributeValueNoRef1 = Exclude<unsigned char, 0, '"', '&'>;
@@ -92,6 +66,16 @@ using Text = Exclude<unsigned char, 0, '<'>;
 using TextNoSpace = Exclude<unsigned char, 0, '\t', '\n', '\r', ' ', '<'>;
 using TextNoRef = Exclude<unsigned char, 0, '&', '<'>;
 using TextNoSpaceRef = Exclude<unsigned char, 0, '\t', '\n', '\r', ' ', '&', '<'>;
+using Tag = Exclude<unsigned char, 0, '=', '>'>;
+
+// Values that only end at characters kept by StructuralIndex
+template <typename Cond> struct Indexed : std::false_type {};
+template <> struct Indexed<AttributeValue1> : std::true_type {};
+template <> struct Indexed<AttributeValueNoRef1> : std::true_type {};
+template <> struct Indexed<AttributeValue2> : std::true_type {};
+template <> struct Indexed<AttributeValueNoRef2> : std::true_type {};
+template <> struct Indexed<Text> : std::true_type {};
+template <> struct Indexed<TextNoRef> : std::true_type {};
 
 struct Decimal {
     
@@ -115,11 +99,241 @@ struct Hexadecimal {
     
 };
 
+// Char production of XML 1.0, which excludes surrogates
+inline bool isChar(std::uint32_t code) {
+    
+    return code < 0xD800 ? code >= 0x20 || code == 0x9 || code == 0xA || code == 0xD
+        : code >= 0xE000 && code <= 0x10FFFF && code != 0xFFFE && code != 0xFFFF;
+    
+}
+
+inline char* encodeUTF8(char* q, std::uint32_t code) {
+    
+    if(code < 0x80) { *q = static_cast<char>(code); return q + 1; }
+    std::size_t n = 2 + (code >= 0x800) + (code >= 0x10000);
+    static const unsigned char LEAD[] = {0, 0, 0xC0, 0xE0, 0xF0};
+    for(std::size_t i = n - 1; i; --i, code >>= 6) q[i] = static_cast<char>(0x80 | (code & 0x3F));
+    q[0] = static_cast<char>(LEAD[n] | code);
+    return q + n;
+    
+}
+
+struct Entity {
+    
+    char name[7];
+    std::size_t length;
+    char value;
+    
+};
+
+// Predefined entities, indexed by the sum of the two characters after '&', which is unique modulo 16
+inline const Entity& getEntity(char c1, char c2) {
+    
+    static const Entity TABLE[16] = {
+        {"&lt;", 4, '<'}, {"&apos;", 6, '\''}, {}, {}, {}, {}, {"&quot;", 6, '"'}, {},
+        {}, {}, {}, {"&gt;", 4, '>'}, {}, {}, {"&amp;", 5, '&'}, {},
+    };
+    return TABLE[(static_cast<unsigned char>(c1) + static_cast<unsigned char>(c2)) & 15];
+    
+}
+
+// Finds the end of a token in push mode, resuming where the previous chunk stopped
+class Scanner {
+    
+private:
+    
+    enum class State : unsigned char {
+        
+        Start, Text, Open, Bang, BangDash, Tag, Comment, CDATA, Doctype, PI,
+        // The internal subset of a document type declaration, and comments and processing instructions in it
+        Subset, SubsetComment, SubsetPI,
+        
+    };
+    
+    State state;
+    char quote;
+    std::size_t count;
+    
+public:
+    
+    Scanner() : state(State::Start), quote(), count() {}
+    
+    bool empty() const { return state == State::Start; }
+    bool isText() const { return state == State::Text; }
+    void reset() { state = State::Start; quote = 0; count = 0; }
+    
+    // Return the end of the token, or nullptr if [p, e) does not complete it. Text ends before '<'.
+    const char* scan(const char* p, const char* e) {
+        
+        while(p != e) {
+            
+            switch(state) {
+                
+            case State::Start: {
+                
+                if(*p == '<') { state = State::Open; ++p; }
+                else state = State::Text;
+                break;
+                
+            }
+            case State::Text: {
+                
+                return static_cast<const char*>(std::memchr(p, '<', e - p));
+                
+            }
+            case State::Open: {
+                
+                if(*p == '!') { state = State::Bang; ++p; }
+                else if(*p == '?') { state = State::PI; ++p; }
+                else state = State::Tag;
+                break;
+                
+            }
+            case State::Bang: {
+                
+                if(*p == '-') { state = State::BangDash; ++p; }
+                else if(*p == '[') { state = State::CDATA; ++p; }
+                else state = State::Doctype;
+                break;
+                
+            }
+            case State::BangDash: {
+                
+                if(*p == '-') { state = State::Comment; ++p; }
+                else state = State::Tag;
+                break;
+                
+            }
+            case State::Tag: {
+                
+                // Quotes only open a value after '='
+                for(; p != e; ++p) {
+                    
+                    if(quote) { if(*p == quote) quote = 0; }
+                    else if(*p == '=') count = 1;
+                    else if(count && (*p == '"' || *p == '\'')) { quote = *p; count = 0; }
+                    else if(*p == '>') return p + 1;
+                    else if(*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') count = 0;
+                    
+                }
+                break;
+                
+            }
+            case State::Comment: {
+                
+                // Until "-->"
+                for(; p != e; ++p) {
+                    
+                    if(*p == '>' && count >= 2) return p + 1;
+                    count = *p == '-' ? count + 1 : 0;
+                    
+                }
+                break;
+                
+            }
+            case State::CDATA: {
+                
+                // Until "]]>"
+                for(; p != e; ++p) {
+                    
+                    if(*p == '>' && count >= 2) return p + 1;
+                    count = *p == ']' ? count + 1 : 0;
+                    
+                }
+                break;
+                
+            }
+            case State::Doctype: {
+                
+                // Until '>' outside of quotes and of the internal subset
+                for(; p != e; ++p) {
+                    
+                    if(quote) { if(*p == quote) quote = 0; }
+                    else if(*p == '"' || *p == '\'') quote = *p;
+                    else if(*p == '[') { state = State::Subset; ++p; break; }
+                    else if(*p == '>') return p + 1;
+                    
+                }
+                break;
+                
+            }
+            case State::Subset: {
+                
+                // Until ']' outside of quotes, comments and processing instructions. count is the length of the
+                // "<!--" or "<?" matched so far.
+                for(; p != e && state == State::Subset; ) {
+                    
+                    char c = *p;
+                    if(quote) { if(c == quote) quote = 0; ++p; }
+                    else if(count == 1 && c == '?') { state = State::SubsetPI; count = 0; ++p; }
+                    else if(count && c == "<!--"[count]) {
+                        
+                        if(++count == 4) { state = State::SubsetComment; count = 0; }
+                        ++p;
+                        
+                    } else if(count) count = 0;
+                    else if(c == '<') { count = 1; ++p; }
+                    else if(c == '"' || c == '\'') { quote = c; ++p; }
+                    else if(c == ']') { state = State::Doctype; ++p; }
+                    else ++p;
+                    
+                }
+                break;
+                
+            }
+            case State::SubsetComment: {
+                
+                for(; p != e; ++p) {
+                    
+                    if(*p == '>' && count >= 2) { state = State::Subset; count = 0; ++p; break; }
+                    count = *p == '-' ? count + 1 : 0;
+                    
+                }
+                break;
+                
+            }
+            case State::SubsetPI: {
+                
+                for(; p != e; ++p) {
+                    
+                    if(*p == '>' && count) { state = State::Subset; count = 0; ++p; break; }
+                    count = *p == '?';
+                    
+                }
+                break;
+                
+            }
+            case State::PI: {
+                
+                // Until "?>"
+                for(; p != e; ++p) {
+                    
+                    if(*p == '>' && count) return p + 1;
+                    count = *p == '?';
+                    
+                }
+                break;
+                
+            }
+            
+            }
+            
+        }
+        return nullptr;
+        
+    }
+    
+};
+
 }
 
 
 class Parser {
     
+    template <typename A>
+    friend class BasicDocument;
+    friend class ParallelParser;
+    
 public:
     
     enum class Flag : std::uint32_t {
@@ -129,6 +343,10 @@ public:
         NormalizeSpace = 0x00000002,
         EntityTranslation = 0x00000004,
         ClosingTagValidate = 0x00000008,
+        NonDestructive = 0x00000010,
+        StructuralIndex = 0x00000020,
+        Statistics = 0x00000040,
+        InternalEntities = 0x00000080,
         
         Default = TrimSpace | EntityTranslation,
         
@@ -157,16 +375,125 @@ public:
         Exception(const Exception& src) : pos(src.pos), str(src.str) {}
         
         const char* what() const noexcept final { return str; }
+        std::size_t getPosition() const { return pos; }
+        
+    };
+    
+    // Returned by tryParse, error is nullptr on success and otherwise the message parse would throw
+    struct Result {
+        
+        const char* error;
+        std::size_t position;
+        
+        explicit operator bool() const { return !error; }
+        
+    };
+    
+    // Line and column of a position, both 1-based and counted in bytes
+    struct Location {
+        
+        std::size_t line;
+        std::size_t column;
+        
+    };
+    
+    // Collected with Flag::Statistics since the start of the last parse. Skipped content and the constructs
+    // of callbacks the handler does not use are only counted as bytes.
+    struct Statistics {
+        
+        std::size_t elements;
+        std::size_t attributes;
+        std::size_t texts;
+        // Entity and character references translated
+        std::size_t references;
+        std::size_t maxDepth;
+        
+        // Bytes of the input in each construct, tags with their attributes
+        std::size_t tagBytes;
+        std::size_t attributeBytes;
+        std::size_t textBytes;
+        std::size_t cdataBytes;
+        std::size_t commentBytes;
+        std::size_t processingInstructionBytes;
+        std::size_t skippedBytes;
+        // Bytes moved to close the gaps left by translation
+        std::size_t copiedBytes;
         
     };
     
 private:
     
+    struct OpenElement {
+        
+        const char* name;
+        std::size_t nameLength;
+        
+    };
+    
+    // A general entity declared in the internal subset, with its references already replaced
+    struct Entity {
+        
+        std::string name;
+        std::string value;
+        
+    };
+    
+    // Thrown when the handler returns Directive::Stop
+    struct Stopped {};
+    
+    // Set by tryParse: errors and Directive::Stop are recorded instead of thrown, and every caller returns as
+    // soon as failed<F>() is true
+    static constexpr Flag NO_THROW = static_cast<Flag>(0x80000000);
+    
     char* s;
     char* p;
+    char* e;
+    
+    std::vector<OpenElement> stack;
+    std::size_t maxDepth;
+    
+    // Translated values in NonDestructive mode, and values that outgrow their place with Flag::InternalEntities
+    std::vector<char> buffer;
+    
+    // Flag::InternalEntities
+    std::vector<Entity> entities;
+    std::size_t maxEntityExpansion;
+    // Bytes produced by replacing declared entities since the start of the parse, and the size of the input the
+    // default limit is taken from, 0 until it is needed for an in-situ input
+    std::size_t expansion;
+    std::size_t inputSize;
+    
+    // Flag::StructuralIndex
+    StructuralIndex index;
+    bool indexed;
+    
+    // Push mode
+    Impl::Scanner scanner;
+    std::vector<char> carry;
+    std::vector<char> names;
+    std::vector<std::size_t> nameLengths;
+    std::size_t position;
+    std::size_t skipDepth;
+    bool started;
+    bool declaration;
+    bool stopped;
+    
+    Statistics statistics;
+    
+    // NO_THROW
+    const char* error;
+    std::size_t errorPosition;
+    bool aborted;
     
 private:
     
+    // Constructs reported to callbacks the handler ignores are only scanned over, without translation or writes
+    template <typename H>
+    static constexpr bool uses(Callback callback) {
+        
+        return Impl::Callbacks<H>::value & callback;
+        
+    }
     static bool compare(const char* p1, const char* p2, size_t length) {
         
         for(const char* end = p1 + length; p1 < end; ++p1, ++p2) {
@@ -182,218 +509,589 @@ private:
         
     }
     
-private:
-    
+    // In NonDestructive mode the input ends at e instead of a NUL, and reads past e return 0
     template <Flag F>
-    void parseReference(char*& q) {
+    char at(std::size_t i = 0) const {
         
-        using namespace Corecat::Sequence;
+        return !(F & Flag::NonDestructive) || i < static_cast<std::size_t>(e - p) ? p[i] : 0;
         
-        switch(p[1]) {
+    }
+    template <Flag F>
+    bool end() const {
         
-        case 0: throw Exception(p - s, "unexpected end");
-        case '#': {
-            
-            if(p[2] == 'x') {
-                
-                p += 3;
-                if(*p == ';') throw Exception(p - s, "unexpected ;");
-                std::uint32_t code = 0;
-                for(unsigned char t; (t = Table<Mapper<Impl::Hexadecimal, Index<unsigned char, 0, 255>>>::get(*p)) != 255; code = code * 16 + t, ++p);
-                if(*p != ';') throw Exception(p - s, "expected ;");
-                ++p;
-                // TODO: Code conversion
-                *q = code;
-                ++q;
-                
-            } else {
-                
-                p += 2;
-                if(*p == ';') throw Exception(p - s, "unexpected ;");
-                std::uint32_t code = 0;
-                for(unsigned char t; (t = Table<Mapper<Impl::Decimal, Index<unsigned char, 0, 255>>>::get(*p)) != 255; code = code * 10 + t, ++p);
-                if(*p != ';') throw Exception(p - s, "expected ;");
-                ++p;
-                // TODO: Code conversion
-                *q = code;
-                ++q;
-                
-            }
-            return;
-            
-        }
-        case 'a': {
-            
-            if(p[2] == 'm' && p[3] == 'p' && p[4] == ';') {
-                
-                // amp
-                p += 5;
-                *q = '&';
-                ++q;
-                return;
-                
-            }
-            if(p[2] == 'p' && p[3] == 'o' && p[4] == 's' && p[5] == ';') {
-                
-                // apos
-                p += 6;
-                *q = '\'';
-                ++q;
-                return;
-                
-            }
-            break;
-            
-        }
-        case 'g': {
-            
-            if(p[2] == 't' && p[3] == ';') {
-                
-                // gt
-                p += 4;
-                *q = '>';
-                ++q;
-                return;
-                
-            }
-            break;
-            
-        }
-        case 'l': {
-            
-            if(p[2] == 't' && p[3] == ';') {
-                
-                // lt
-                p += 4;
-                *q = '<';
-                ++q;
-                return;
-                
-            }
-            break;
-            
-        }
-        case 'q': {
-            
-            if(p[2] == 'u' && p[3] == 'o' && p[4] == 't' && p[5] == ';') {
-                
-                // quot
-                p += 6;
-                *q = '"';
-                ++q;
-                return;
-                
-            }
-            break;
-            
-        }
-        default: {
-            
-            break;
-            
-        }
+        return F & Flag::NonDestructive ? p == e : !*p;
         
-        }
-        throw Exception(p - s, "unexpected reference");
+    }
+    template <Flag F, std::size_t N>
+    bool match(const char (&str)[N]) const {
+        
+        if(F & Flag::NonDestructive && static_cast<std::size_t>(e - p) < N - 1) return false;
+        return compare(p, str, N - 1);
         
     }
-    template <Flag F, typename H>
-    void parseXMLDeclaration(H& /*handler*/) {
+    template <Flag F>
+    bool match(const char* str, std::size_t length) const {
         
-        using namespace Corecat::Sequence;
+        if(F & Flag::NonDestructive && static_cast<std::size_t>(e - p) < length) return false;
+        return compare(p, str, length);
         
-        Impl::Skipper<Impl::Space>::skip(p);
+    }
+    template <Flag F, typename Cond>
+    std::size_t skip() {
         
-        // Parse "version"
-        if(p[0] != 'v' || p[1] != 'e' || p[2] != 'r' || p[3] != 's' || p[4] != 'i' || p[5] != 'o' || p[6] != 'n')
-            throw Exception(p - s, "expected version");
-        p += 7;
-        Impl::Skipper<Impl::Space>::skip(p);
-        if(*p != '=') throw Exception(p - s, "expected =");
-        ++p;
-        Impl::Skipper<Impl::Space>::skip(p);
-        if(*p == '"') {
-            
-            ++p;
-            Impl::Skipper<Impl::AttributeValue1>::skip(p);
-            if(*p != '"') throw Exception(p - s, "expected \"");
-
-        } else if(*p == '\'') {
-            
-            ++p;
-            Impl::Skipper<Impl::AttributeValue2>::skip(p);
-            if(*p != '\'') throw Exception(p - s, "expected '");
-            
-        } else throw Exception(p - s, "expected \" or '");
-        ++p;
+        return F & Flag::NonDestructive ? Impl::Skipper<Cond>::skip(p, e) : Impl::Skipper<Cond>::skip(p);
         
-        if(*p != '?' && !Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(*p))
-            throw Exception(p - s, "unexpected character");
-        Impl::Skipper<Impl::Space>::skip(p);
+    }
+    // Skip like skip<F, Cond>(), jumping between structural positions when the input is indexed
+    template <Flag F, typename Cond>
+    std::size_t skipValue() {
         
-        // Parse "encoding"
-        if(p[0] == 'e' && p[1] == 'n' && p[2] == 'c' && p[3] == 'o' && p[4] == 'd' && p[5] == 'i' && p[6] == 'n' && p[7] == 'g') {
+        using namespace Corecat::Sequence;
+        
+        if(!(F & Flag::StructuralIndex) || !Impl::Indexed<Cond>::value || !indexed) return skip<F, Cond>();
+        auto t = p;
+        while(true) {
             
-            p += 8;
-            Impl::Skipper<Impl::Space>::skip(p);
-            if(*p != '=') throw Exception(p - s, "expected =");
-            ++p;
-            Impl::Skipper<Impl::Space>::skip(p);
-            if(*p == '"') {
-                
-                ++p;
-                Impl::Skipper<Impl::AttributeValue1>::skip(p);
-                if(*p != '"') throw Exception(p - s, "expected \"");
-    
-            } else if(*p == '\'') {
-                
-                ++p;
-                Impl::Skipper<Impl::AttributeValue2>::skip(p);
-                if(*p != '\'') throw Exception(p - s, "expected '");
-                
-            } else throw Exception(p - s, "expected \" or '");
+            std::size_t i = index.next(p - s);
+            p = s + i;
+            if(i == index.getSize() || !Table<Mapper<Cond, Index<unsigned char, 0, 255>>>::get(*p)) break;
             ++p;
             
         }
+        return p - t;
         
-        if(*p != '?' && !Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(*p))
-            throw Exception(p - s, "unexpected character");
-        Impl::Skipper<Impl::Space>::skip(p);
+    }
+    // Move p to the first terminator ending with '>' of a comment, CDATA section or processing instruction using
+    // the index, stopping early at a NUL; the scan that follows then matches at once
+    template <Flag F, std::size_t N>
+    void seek(const char (&terminator)[N]) {
+        
+        if(!(F & Flag::StructuralIndex) || !indexed) return;
+        const std::size_t n = N - 1, begin = p - s;
+        std::size_t i = index.next(begin);
+        for(; i != index.getSize() && s[i]; i = index.next(i + 1)) {
+            
+            if(s[i] == '>' && i + 1 >= begin + n && compare(s + i + 1 - n, terminator, n)) { p = s + i + 1 - n; return; }
+            
+        }
+        p = s + i;
+        
+    }
+    // Move p past the terminator
+    template <Flag F, std::size_t N>
+    void skipPast(const char (&terminator)[N]) {
+        
+        seek<F>(terminator);
+        while(at<F>() && !match<F>(terminator)) ++p;
+        if(!at<F>()) return fail<F>(p - s, "unexpected end");
+        p += N - 1;
+        
+    }
+    template <Flag F>
+    void fail(std::size_t pos, const char* str) {
+        
+        if(!(F & NO_THROW)) throw Exception(pos, str);
+        error = str;
+        errorPosition = pos;
+        aborted = true;
+        
+    }
+    template <Flag F>
+    bool failed() const { return F & NO_THROW && aborted; }
+    template <Flag F>
+    void stop() {
+        
+        if(!(F & NO_THROW)) throw Stopped();
+        aborted = true;
+        
+    }
+    template <Flag F>
+    static void terminate(char* t) {
+        
+        if(!(F & Flag::NonDestructive)) *t = 0;
+        
+    }
+    static bool isSpace(char c) {
+        
+        using namespace Corecat::Sequence;
+        
+        return Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(c);
+        
+    }
+    template <Flag F>
+    void countDepth(std::size_t depth) {
+        
+        if(F & Flag::Statistics) statistics.maxDepth = std::max(statistics.maxDepth, depth);
+        
+    }
+    // Declarations are few, so the table is searched in order
+    const std::string* findEntity(const char* name, std::size_t nameLength) const {
+        
+        for(auto& entity : entities)
+            if(entity.name.size() == nameLength && compare(entity.name.data(), name, nameLength)) return &entity.value;
+        return nullptr;
+        
+    }
+    
+private:
+    
+    // Count the bytes of a replacement, failing at pos once the expansion exceeds the limit
+    template <Flag F>
+    bool expand(std::size_t length, std::size_t pos) {
+        
+        expansion += length;
+        std::size_t limit = maxEntityExpansion;
+        if(!limit) {
+            
+            // An in-situ input is not written yet after p
+            if(!inputSize) inputSize = e ? e - s : (p - s) + std::strlen(p);
+            limit = std::max(inputSize * DEFAULT_ENTITY_EXPANSION_FACTOR, std::size_t(MIN_ENTITY_EXPANSION));
+            
+        }
+        if(expansion <= limit) return true;
+        fail<F>(pos, "entity expansion too large");
+        return false;
+        
+    }
+    // Write the translation to q, except for a declared entity, whose replacement is returned instead
+    template <Flag F>
+    const std::string* parseReference(char*& q) {
+        
+        using namespace Corecat::Sequence;
+        
+        char c = at<F>(1);
+        if(!c) return fail<F>(p - s, "unexpected end"), nullptr;
+        if(c == '#') {
+            
+            bool hex = at<F>(2) == 'x';
+            p += hex ? 3 : 2;
+            if(at<F>() == ';') return fail<F>(p - s, "unexpected ;"), nullptr;
+            // Saturate past the last code point so that long references cannot wrap around
+            std::uint32_t code = 0;
+            if(hex) for(unsigned char t; (t = Table<Mapper<Impl::Hexadecimal, Index<unsigned char, 0, 255>>>::get(at<F>())) != 255; code = std::min<std::uint32_t>(code * 16 + t, 0x110000), ++p);
+            else for(unsigned char t; (t = Table<Mapper<Impl::Decimal, Index<unsigned char, 0, 255>>>::get(at<F>())) != 255; code = std::min<std::uint32_t>(code * 10 + t, 0x110000), ++p);
+            if(at<F>() != ';') return fail<F>(p - s, "expected ;"), nullptr;
+            if(!Impl::isChar(code)) return fail<F>(p - s, "invalid character reference"), nullptr;
+            ++p;
+            if(F & Flag::Statistics) ++statistics.references;
+            // The encoding is never longer than the reference
+            q = Impl::encodeUTF8(q, code);
+            return nullptr;
+            
+        }
+        auto& entity = Impl::getEntity(c, at<F>(2));
+        if(entity.length && match<F>(entity.name, entity.length)) {
+            
+            p += entity.length;
+            *(q++) = entity.value;
+            if(F & Flag::Statistics) ++statistics.references;
+            return nullptr;
+            
+        }
+        if(F & Flag::InternalEntities) {
+            
+            auto t = p++;
+            auto name = p;
+            std::size_t nameLength = skip<F, Impl::EntityName>();
+            auto value = at<F>() == ';' ? findEntity(name, nameLength) : nullptr;
+            if(value) {
+                
+                ++p;
+                if(F & Flag::Statistics) ++statistics.references;
+                return value;
+                
+            }
+            p = t;
+            
+        }
+        return fail<F>(p - s, "unexpected reference"), nullptr;
+        
+    }
+    // Write the replacement of a declared entity, which may be longer than its reference. In place it has to end
+    // before p, otherwise the value moves to the buffer, which then grows by what each replacement adds.
+    template <Flag F, typename RawCond>
+    void insert(char*& value, char*& q, const std::string& replacement, std::size_t referenceLength) {
+        
+        std::size_t length = replacement.size();
+        std::size_t used = q - value;
+        if(!isBuffered(value)) {
+            
+            if(static_cast<std::size_t>(p - q) >= length) {
+                
+                q = std::copy(replacement.begin(), replacement.end(), q);
+                return;
+                
+            }
+            auto t = p;
+            skipValue<F, RawCond>();
+            buffer.resize(used + length + (p - t) + 1);
+            p = t;
+            std::copy(value, q, buffer.data());
+            if(F & Flag::Statistics) statistics.copiedBytes += used;
+            
+        } else if(length > referenceLength) buffer.resize(buffer.size() + length - referenceLength);
+        value = buffer.data();
+        q = std::copy(replacement.begin(), replacement.end(), value + used);
+        
+    }
+    // Parse a value up to the delimiter D and return its length, leaving p at D. Cond stops at D and at
+    // every character that needs rewriting ('&' and space), RawCond only at D. The value is rewritten in
+    // place, or in NonDestructive mode copied to the buffer once the first rewrite is needed. A declared
+    // entity may move an in-place value to the buffer as well.
+    template <Flag F, typename Cond, typename RawCond, char D>
+    std::size_t parseValue(char*& value) {
+        
+        auto begin = p;
+        value = p;
+        char* q = nullptr;
+        while(true) {
+            
+            auto t = p;
+            auto len = skipValue<F, Cond>();
+            if(q) {
+                
+                if(q != t) {
+                    
+                    std::copy(t, p, q);
+                    if(F & Flag::Statistics) statistics.copiedBytes += len;
+                    
+                }
+                q += len;
+                
+            }
+            char c = at<F>();
+            if(c == D) break;
+            if(!c) return fail<F>(p - s, "unexpected end"), 0;
+            if(!q && !(c == ' ' && !isSpace(at<F>(1)))) {
+                
+                if(F & Flag::NonDestructive) {
+                    
+                    // The rewritten value is never longer than the raw one
+                    skipValue<F, RawCond>();
+                    buffer.resize(p - begin);
+                    q = std::copy(begin, t + len, buffer.data());
+                    if(F & Flag::Statistics) statistics.copiedBytes += t + len - begin;
+                    value = buffer.data();
+                    p = t + len;
+                    
+                } else q = p;
+                
+            }
+            if(c == '&') {
+                
+                auto t = p;
+                auto replacement = parseReference<F>(q);
+                if(failed<F>()) return 0;
+                if(F & Flag::InternalEntities && replacement) {
+                    
+                    if(!expand<F>(replacement->size(), t - s)) return 0;
+                    insert<F, RawCond>(value, q, *replacement, p - t);
+                    
+                }
+                
+            } else {
+                
+                // Single spaces are kept as they are
+                skip<F, Impl::Space>();
+                if(q) *(q++) = ' ';
+                
+            }
+            
+        }
+        std::size_t length = (q ? q : p) - value;
+        if(D == '<' && F & Flag::TrimSpace)
+            for(; length && isSpace(value[length - 1]); --length);
+        terminate<F>(value + length);
+        return length;
+        
+    }
+    template <Flag F, typename H>
+    void parseXMLDeclaration(H& /*handler*/) {
+        
+        skip<F, Impl::Space>();
+        
+        // Parse "version"
+        if(!match<F>("version"))
+            return fail<F>(p - s, "expected version");
+        p += 7;
+        skip<F, Impl::Space>();
+        if(at<F>() != '=') return fail<F>(p - s, "expected =");
+        ++p;
+        skip<F, Impl::Space>();
+        if(at<F>() == '"') {
+            
+            ++p;
+            skip<F, Impl::AttributeValue1>();
+            if(at<F>() != '"') return fail<F>(p - s, "expected \"");
+
+        } else if(at<F>() == '\'') {
+            
+            ++p;
+            skip<F, Impl::AttributeValue2>();
+            if(at<F>() != '\'') return fail<F>(p - s, "expected '");
+            
+        } else return fail<F>(p - s, "expected \" or '");
+        ++p;
+        
+        if(at<F>() != '?' && !isSpace(at<F>()))
+            return fail<F>(p - s, "unexpected character");
+        skip<F, Impl::Space>();
+        
+        // Parse "encoding"
+        if(match<F>("encoding")) {
+            
+            p += 8;
+            skip<F, Impl::Space>();
+            if(at<F>() != '=') return fail<F>(p - s, "expected =");
+            ++p;
+            skip<F, Impl::Space>();
+            if(at<F>() == '"') {
+                
+                ++p;
+                skip<F, Impl::AttributeValue1>();
+                if(at<F>() != '"') return fail<F>(p - s, "expected \"");
+    
+            } else if(at<F>() == '\'') {
+                
+                ++p;
+                skip<F, Impl::AttributeValue2>();
+                if(at<F>() != '\'') return fail<F>(p - s, "expected '");
+                
+            } else return fail<F>(p - s, "expected \" or '");
+            ++p;
+            
+        }
+        
+        if(at<F>() != '?' && !isSpace(at<F>()))
+            return fail<F>(p - s, "unexpected character");
+        skip<F, Impl::Space>();
         
         // Parse "standalone"
-        if(p[0] == 's' && p[1] == 't' && p[2] == 'a' && p[3] == 'n' && p[4] == 'd' && p[5] == 'a' && p[6] == 'l' && p[7] == 'o' && p[8] == 'n' && p[9] == 'e') {
+        if(match<F>("standalone")) {
             
             p += 10;
-            Impl::Skipper<Impl::Space>::skip(p);
-            if(*p != '=') throw Exception(p - s, "expected =");
+            skip<F, Impl::Space>();
+            if(at<F>() != '=') return fail<F>(p - s, "expected =");
             ++p;
-            Impl::Skipper<Impl::Space>::skip(p);
-            if(*p == '"') {
+            skip<F, Impl::Space>();
+            if(at<F>() == '"') {
                 
                 ++p;
-                Impl::Skipper<Impl::AttributeValue1>::skip(p);
-                if(*p != '"') throw Exception(p - s, "expected \"");
+                skip<F, Impl::AttributeValue1>();
+                if(at<F>() != '"') return fail<F>(p - s, "expected \"");
     
-            } else if(*p == '\'') {
+            } else if(at<F>() == '\'') {
                 
                 ++p;
-                Impl::Skipper<Impl::AttributeValue2>::skip(p);
-                if(*p != '\'') throw Exception(p - s, "expected '");
+                skip<F, Impl::AttributeValue2>();
+                if(at<F>() != '\'') return fail<F>(p - s, "expected '");
                 
-            } else throw Exception(p - s, "expected \" or '");
+            } else return fail<F>(p - s, "expected \" or '");
             ++p;
             
         }
         
-        Impl::Skipper<Impl::Space>::skip(p);
-        if(p[0] != '?' || p[1] != '>') throw Exception(p - s, "expected ?>");
+        skip<F, Impl::Space>();
+        if(!match<F>("?>")) return fail<F>(p - s, "expected ?>");
         p += 2;
         
+    }
+    // Parse a quoted literal and return its start, leaving p after the closing quote
+    template <Flag F>
+    char* parseLiteral(std::size_t& length) {
+        
+        char quote = at<F>();
+        if(quote != '"' && quote != '\'') return fail<F>(p - s, "expected \" or '"), nullptr;
+        auto literal = ++p;
+        if(quote == '"') skip<F, Impl::AttributeValue1>();
+        else skip<F, Impl::AttributeValue2>();
+        if(at<F>() != quote) return fail<F>(p - s, "unexpected end"), nullptr;
+        length = p - literal;
+        ++p;
+        return literal;
+        
+    }
+    // Whether parseReference translates the reference at p
+    template <Flag F>
+    bool isTranslated() {
+        
+        if(at<F>(1) == '#') return true;
+        auto& entity = Impl::getEntity(at<F>(1), at<F>(2));
+        if(entity.length && match<F>(entity.name, entity.length)) return true;
+        auto t = p++;
+        auto name = p;
+        std::size_t nameLength = skip<F, Impl::EntityName>();
+        bool found = at<F>() == ';' && findEntity(name, nameLength);
+        p = t;
+        return found;
+        
+    }
+    // Replace the character references and the references to entities declared before in an entity value,
+    // keeping the other references as they are
+    template <Flag F>
+    std::string expandEntityValue(char* value, std::size_t valueLength) {
+        
+        std::string expanded;
+        auto t = p;
+        p = value;
+        for(char* end = value + valueLength; p < end; ) {
+            
+            auto r = static_cast<char*>(std::memchr(p, '&', end - p));
+            if(!r) r = end;
+            expanded.append(p, r);
+            p = r;
+            if(p == end) break;
+            if(!isTranslated<F>()) {
+                
+                expanded += '&';
+                ++p;
+                continue;
+                
+            }
+            char code[4];
+            char* q = code;
+            auto reference = p;
+            auto replacement = parseReference<F>(q);
+            if(failed<F>()) return expanded;
+            if(replacement && !expand<F>(replacement->size(), reference - s)) return expanded;
+            if(replacement) expanded += *replacement;
+            else expanded.append(code, q);
+            
+        }
+        p = t;
+        return expanded;
+        
+    }
+    // Parse an entity declaration after "<!ENTITY". Only the first declaration of an internal general entity is
+    // kept; parameter and external entities are skipped.
+    template <Flag F>
+    void parseEntityDeclaration() {
+        
+        skip<F, Impl::Space>();
+        bool parameter = at<F>() == '%';
+        if(parameter) {
+            
+            ++p;
+            if(!skip<F, Impl::Space>()) return fail<F>(p - s, "expected space");
+            
+        }
+        auto name = p;
+        std::size_t nameLength = skip<F, Impl::EntityName>();
+        if(!nameLength) return fail<F>(p - s, "expected name");
+        if(!skip<F, Impl::Space>()) return fail<F>(p - s, "expected space");
+        if(at<F>() == '"' || at<F>() == '\'') {
+            
+            std::size_t valueLength;
+            auto value = parseLiteral<F>(valueLength);
+            if(failed<F>()) return;
+            if(!parameter && !findEntity(name, nameLength)) {
+                
+                auto expanded = expandEntityValue<F>(value, valueLength);
+                if(failed<F>()) return;
+                entities.push_back(Entity{std::string(name, nameLength), std::move(expanded)});
+                
+            }
+            
+        }
+        for(char c; (c = at<F>()) && c != '>'; ) {
+            
+            std::size_t length;
+            if(c == '"' || c == '\'') parseLiteral<F>(length);
+            else ++p;
+            if(failed<F>()) return;
+            
+        }
+        if(!at<F>()) return fail<F>(p - s, "unexpected end");
+        ++p;
+        
+    }
+    // Scan the internal subset up to ']', stepping over the literals, comments and processing instructions that
+    // may contain one
+    template <Flag F>
+    void parseInternalSubset() {
+        
+        while(true) {
+            
+            skip<F, Impl::InternalSubset>();
+            char c = at<F>();
+            if(!c) return fail<F>(p - s, "unexpected end");
+            if(c == ']') break;
+            if(c == '<') {
+                
+                if(match<F>("<!--")) { p += 4; skipPast<F>("-->"); }
+                else if(match<F>("<?")) { p += 2; skipPast<F>("?>"); }
+                else if(F & Flag::InternalEntities && match<F>("<!ENTITY") && isSpace(at<F>(8))) {
+                    
+                    p += 8;
+                    parseEntityDeclaration<F>();
+                    
+                } else ++p;
+                
+            } else {
+                
+                std::size_t length;
+                parseLiteral<F>(length);
+                
+            }
+            if(failed<F>()) return;
+            
+        }
+        
     }
     template <Flag F, typename H>
-    void parseDoctype(H& /*handler*/) {
+    void parseDoctype(H& handler) {
         
-        throw Exception(p - s, "not implemented");
+        if(!skip<F, Impl::Space>()) return fail<F>(p - s, "expected space");
+        auto name = p;
+        std::size_t nameLength = skip<F, Impl::DoctypeName>();
+        if(!nameLength) return fail<F>(p - s, "expected name");
+        skip<F, Impl::Space>();
+        
+        // Parse the external ID
+        const char* publicId = "";
+        const char* systemId = "";
+        std::size_t publicIdLength = 0;
+        std::size_t systemIdLength = 0;
+        bool pub = match<F>("PUBLIC");
+        if(pub || match<F>("SYSTEM")) {
+            
+            p += 6;
+            if(!skip<F, Impl::Space>()) return fail<F>(p - s, "expected space");
+            if(pub) {
+                
+                auto literal = parseLiteral<F>(publicIdLength);
+                if(failed<F>()) return;
+                if(!skip<F, Impl::Space>()) return fail<F>(p - s, "expected space");
+                terminate<F>(literal + publicIdLength);
+                publicId = literal;
+                
+            }
+            auto literal = parseLiteral<F>(systemIdLength);
+            if(failed<F>()) return;
+            skip<F, Impl::Space>();
+            terminate<F>(literal + systemIdLength);
+            systemId = literal;
+            
+        }
+        
+        // Parse the internal subset
+        char* subset = p;
+        std::size_t subsetLength = 0;
+        if(at<F>() == '[') {
+            
+            subset = ++p;
+            parseInternalSubset<F>();
+            if(failed<F>()) return;
+            subsetLength = p - subset;
+            ++p;
+            skip<F, Impl::Space>();
+            
+        }
+        if(at<F>() != '>') return fail<F>(p - s, "expected >");
+        terminate<F>(subset + subsetLength);
+        terminate<F>(name + nameLength);
+        ++p;
+        handler.doctype(name, nameLength, publicId, publicIdLength, systemId, systemIdLength, subset, subsetLength);
         
     }
     template <Flag F, typename H>
@@ -401,417 +1099,860 @@ private:
         
         auto comment = p;
         // Until "-->"
-        while(*p && (p[0] != '-' || p[1] != '-' || p[2] != '>')) ++p;
-        if(!*p) throw Exception(p - s, "unexpected end");
+        seek<F>("-->");
+        while(at<F>() && !match<F>("-->")) ++p;
+        if(!at<F>()) return fail<F>(p - s, "unexpected end");
         std::size_t commentLength = p - comment;
-        *p = 0;
+        if(F & Flag::Statistics) statistics.commentBytes += commentLength;
+        if(uses<H>(Callback::Comment)) {
+            
+            terminate<F>(p);
+            handler.comment(comment, commentLength);
+            
+        }
+        p += 3;
+        
+    }
+    template <Flag F, typename H>
+    void parseProcessingInstruction(H& handler) {
+        
+        auto target = p;
+        std::size_t targetLength = skip<F, Impl::Name>();
+        if(!targetLength) return fail<F>(p - s, "expected PI target");
+        auto targetEnd = p;
+        if(!match<F>("?>") && !skip<F, Impl::Space>())
+            return fail<F>(p - s, "expected space");
+        auto content = p;
+        // Until "?>"
+        seek<F>("?>");
+        while(at<F>() && !match<F>("?>")) ++p;
+        if(!at<F>()) return fail<F>(p - s, "unexpected end");
+        std::size_t contentLength = p - content;
+        if(F & Flag::Statistics) statistics.processingInstructionBytes += p - target;
+        if(uses<H>(Callback::ProcessingInstruction)) {
+            
+            terminate<F>(targetEnd);
+            terminate<F>(p);
+            handler.processingInstruction(target, targetLength, content, contentLength);
+            
+        }
+        p += 2;
+        
+    }
+    template <Flag F, typename H>
+    void parseCDATA(H& handler) {
+        
+        auto text = p;
+        // Until "]]>"
+        seek<F>("]]>");
+        while(at<F>() && !match<F>("]]>")) ++p;
+        if(!at<F>()) return fail<F>(p - s, "unexpected end");
+        std::size_t textLength = p - text;
+        if(F & Flag::Statistics) statistics.cdataBytes += textLength;
+        if(uses<H>(Callback::CDATA)) {
+            
+            terminate<F>(p);
+            handler.cdata(text, textLength);
+            
+        }
         p += 3;
-        handler.comment(comment, commentLength);
         
-    }
-    template <Flag F, typename H>
-    void parseProcessingInstruction(H& handler) {
+    }
+    // Move p past the rest of a start tag after its type and return whether it ends with "/>"
+    template <Flag F>
+    bool skipTag() {
+        
+        // Attribute values may contain '>', names may contain quotes
+        while(skip<F, Impl::Tag>(), at<F>() == '=') {
+            
+            ++p;
+            skip<F, Impl::Space>();
+            if(at<F>() == '"') ++p, skip<F, Impl::AttributeValue1>();
+            else if(at<F>() == '\'') ++p, skip<F, Impl::AttributeValue2>();
+            else continue;
+            if(!at<F>()) return fail<F>(p - s, "unexpected end"), false;
+            ++p;
+            
+        }
+        if(!at<F>()) return fail<F>(p - s, "unexpected end"), false;
+        return p++[-1] == '/';
+        
+    }
+    // Skip the content of an element after its start tag up to its end tag, balancing tags without emitting
+    // events or writing to the input
+    template <Flag F>
+    void skipContent() {
+        
+        std::size_t depth = 0;
+        while(true) {
+            
+            skipValue<F, Impl::Text>();
+            if(at<F>() != '<') return fail<F>(p - s, "unexpected end");
+            switch(at<F>(1)) {
+                
+            case '/': {
+                
+                if(!depth) return;
+                --depth;
+                p += 2;
+                skipPast<F>(">");
+                break;
+                
+            }
+            case '!': {
+                
+                if(match<F>("<!--")) {
+                    
+                    p += 4;
+                    skipPast<F>("-->");
+                    
+                } else if(match<F>("<![CDATA[")) {
+                    
+                    p += 9;
+                    skipPast<F>("]]>");
+                    
+                } else return fail<F>(p + 2 - s, "unexpected character");
+                break;
+                
+            }
+            case '?': {
+                
+                p += 2;
+                skipPast<F>("?>");
+                break;
+                
+            }
+            default: {
+                
+                ++p;
+                skip<F, Impl::Name>();
+                if(!skipTag<F>()) ++depth;
+                break;
+                
+            }
+            
+            }
+            if(failed<F>()) return;
+            
+        }
+        
+    }
+    // Parse the attributes of a start tag after the space following the type, and return whether the element
+    // is empty
+    template <Flag F, typename H>
+    bool parseAttributes(H& handler) {
+        
+        using namespace Corecat::Sequence;
+        
+        skip<F, Impl::Space>();
+        while(Table<Mapper<Impl::AttributeName, Index<unsigned char, 0, 255>>>::get(at<F>())) {
+            
+            // Parse attribute name
+            auto name = p;
+            std::size_t nameLength = skip<F, Impl::AttributeName>();
+            auto nameEnd = p;
+            skip<F, Impl::Space>();
+            if(at<F>() != '=') return fail<F>(p - s, "expected ="), false;
+            terminate<F>(nameEnd);
+            ++p;
+            skip<F, Impl::Space>();
+            
+            // Parse attribute value
+            char* value;
+            std::size_t valueLength;
+            auto raw = p + 1;
+            if(at<F>() == '"') {
+                
+                ++p;
+                if(F & Flag::EntityTranslation)
+                    valueLength = parseValue<F, Impl::AttributeValueNoRef1, Impl::AttributeValue1, '"'>(value);
+                else
+                    valueLength = parseValue<F, Impl::AttributeValue1, Impl::AttributeValue1, '"'>(value);
+                
+            } else if(at<F>() == '\'') {
+                
+                ++p;
+                if(F & Flag::EntityTranslation)
+                    valueLength = parseValue<F, Impl::AttributeValueNoRef2, Impl::AttributeValue2, '\''>(value);
+                else
+                    valueLength = parseValue<F, Impl::AttributeValue2, Impl::AttributeValue2, '\''>(value);
+                
+            } else return fail<F>(p - s, "expected \" or '"), false;
+            if(failed<F>()) return false;
+            if(F & Flag::Statistics) ++statistics.attributes, statistics.attributeBytes += p - raw;
+            ++p;
+            handler.attribute(name, nameLength, value, valueLength);
+            skip<F, Impl::Space>();
+            
+        }
+        if(at<F>() == '>') {
+            
+            ++p;
+            return false;
+            
+        } else if(at<F>() == '/') {
+            
+            if(at<F>(1) != '>') return fail<F>(p + 1 - s, "expected >"), false;
+            p += 2;
+            return true;
+            
+        } else return fail<F>(p + 1 - s, "unexpected character"), false;
+        
+    }
+    // Parse a start tag after "<" and return whether the element is empty. A content skipped by the handler is
+    // reported and p is left at its end tag, or in push mode the following tokens are ignored up to it.
+    template <Flag F, bool Push = false, typename H>
+    bool parseStartTag(H& handler, char*& name, std::size_t& nameLength) {
+        
+        // Parse element type
+        name = p;
+        nameLength = skip<F, Impl::Name>();
+        if(!nameLength) return fail<F>(p - s, "expected element type"), false;
+        bool empty = false;
+        Directive directive;
+        if(at<F>() == '>') {
+            
+            terminate<F>(p);
+            ++p;
+            directive = Impl::startElement(handler, name, nameLength);
+            
+        } else if(at<F>() == '/') {
+            
+            if(at<F>(1) != '>') return fail<F>(p + 1 - s, "expected >"), false;
+            terminate<F>(p);
+            p += 2;
+            directive = Impl::startElement(handler, name, nameLength);
+            empty = true;
+            
+        } else {
+            
+            if(!isSpace(at<F>())) return fail<F>(p - s, at<F>() ? "unexpected character" : "unexpected end"), false;
+            terminate<F>(p);
+            ++p;
+            directive = Impl::startElement(handler, name, nameLength);
+            // Attributes of a skipped element are not reported
+            empty = directive == Directive::Continue && uses<H>(Callback::Attribute) ? parseAttributes<F>(handler) : skipTag<F>();
+            if(failed<F>()) return false;
+            
+        }
+        if(F & Flag::Statistics) ++statistics.elements, statistics.tagBytes += p - name + 1;
+        if(directive == Directive::Continue) directive = Impl::endAttributes(handler);
+        if(directive == Directive::Stop) return stop<F>(), false;
+        if(directive == Directive::Skip && !empty) {
+            
+            if(Push) {
+                
+                skipDepth = 1;
+                
+            } else {
+                
+                auto content = p;
+                skipContent<F>();
+                if(failed<F>()) return false;
+                if(F & Flag::Statistics) statistics.skippedBytes += p - content;
+                handler.skipped(content, p - content);
+                
+            }
+            
+        }
+        return empty;
+        
+    }
+    // Parse an end tag after "</", name is the type of the open element
+    template <Flag F, typename H>
+    void parseEndTag(H& handler, const char* name, std::size_t nameLength) {
+        
+        if(F & Flag::Statistics) statistics.tagBytes += 2;
+        if(F & Flag::ClosingTagValidate) {
+            
+            auto endName = p;
+            skip<F, Impl::Name>();
+            auto endNameEnd = p;
+            skip<F, Impl::Space>();
+            if(at<F>() != '>') return fail<F>(p - s, "expected >");
+            terminate<F>(endNameEnd);
+            ++p;
+            if(F & Flag::Statistics) statistics.tagBytes += p - endName;
+            handler.endElement(endName, endNameEnd - endName);
+            
+        } else {
+            
+            if((F & Flag::NonDestructive && static_cast<std::size_t>(e - p) < nameLength) || !compare(p, name, nameLength))
+                return fail<F>(p - s, "unmatch element type");
+            auto endName = p;
+            p += nameLength;
+            auto endNameEnd = p;
+            skip<F, Impl::Space>();
+            if(at<F>() != '>') return fail<F>(p - s, "expected >");
+            terminate<F>(endNameEnd);
+            ++p;
+            if(F & Flag::Statistics) statistics.tagBytes += p - endName;
+            handler.endElement(endName, nameLength);
+            
+        }
+        
+    }
+    template <Flag F, typename H>
+    void parseText(H& handler) {
+        
+        if(!uses<H>(Callback::Text)) {
+            
+            auto length = skipValue<F, Impl::Text>();
+            if(!at<F>()) return fail<F>(p - s, "unexpected end");
+            if(F & Flag::Statistics) statistics.textBytes += length;
+            return;
+            
+        }
+        
+        using Cond = typename std::conditional<F & Flag::EntityTranslation,
+            typename std::conditional<F & Flag::NormalizeSpace, Impl::TextNoSpaceRef, Impl::TextNoRef>::type,
+            typename std::conditional<F & Flag::NormalizeSpace, Impl::TextNoSpace, Impl::Text>::type>::type;
         
-        auto target = p;
-        std::size_t targetLength = Impl::Skipper<Impl::Name>::skip(p);
-        if(!targetLength) throw Exception(p - s, "expected PI target");
-        auto targetEnd = p;
-        if((p[0] != '?' || p[1] != '>') && !Impl::Skipper<Impl::Space>::skip(p))
-            throw Exception(p - s, "expected space");
-        auto content = p;
-        // Until "?>"
-        while(*p && (p[0] != '?' || p[1] != '>')) ++p;
-        if(!*p) throw Exception(p - s, "unexpected end");
-        std::size_t contentLength = p - content;
-        *targetEnd = 0;
-        *p = 0;
-        p += 2;
-        handler.processingInstruction(target, targetLength, content, contentLength);
+        char* text;
+        auto raw = p;
+        std::size_t textLength = parseValue<F, Cond, Impl::Text, '<'>(text);
+        if(failed<F>()) return;
+        if(F & Flag::Statistics) ++statistics.texts, statistics.textBytes += p - raw;
+        handler.text(text, textLength);
         
     }
+    // Parse "<!" markup in element content after "<!"
     template <Flag F, typename H>
-    void parseCDATA(H& handler) {
+    void parseContentMarkup(H& handler) {
         
-        auto text = p;
-        // Until "]]>"
-        while(*p && (p[0] != ']' || p[1] != ']' || p[2] != '>')) ++p;
-        if(!*p) throw Exception(p - s, "unexpected end");
-        std::size_t textLength = p - text;
-        *p = 0;
-        p += 3;
-        handler.cdata(text, textLength);
+        if(match<F>("--")) {
+            
+            p += 2;
+            parseComment<F>(handler);
+            
+        } else if(match<F>("[CDATA[")) {
+            
+            // "[CDATA["
+            p += 7;
+            parseCDATA<F>(handler);
+            
+        } else return fail<F>(p - s, "unexpected character");
         
     }
+    // Parse an element after "<" and all of its content, keeping the open elements on the stack
     template <Flag F, typename H>
     void parseElement(H& handler) {
         
-        using namespace Corecat::Sequence;
-        
-        // Parse element type
-        auto name = p;
-        std::size_t nameLength = Impl::Skipper<Impl::Name>::skip(p);
-        if(!nameLength) throw Exception(p - s, "expected element type");
-        bool empty = false;
-        if(*p == '>') {
+        char* name;
+        std::size_t nameLength;
+        bool empty = parseStartTag<F>(handler, name, nameLength);
+        if(failed<F>()) return;
+        if(empty) {
             
-            *p = 0;
-            ++p;
-            handler.startElement(name, nameLength);
-            
-        } else if(*p == '/') {
+            handler.endElement(name, nameLength);
+            return;
             
-            if(p[1] != '>') throw Exception(p + 1 - s, "expected >");
-            *p = 0;
-            p += 2;
-            handler.startElement(name, nameLength);
-            empty = true;
+        }
+        stack.clear();
+        stack.push_back({name, nameLength});
+        countDepth<F>(1);
+        parseContent<F, false>(handler, nullptr);
+        
+    }
+    // Parse the content of the open elements until the stack is empty. When Bounded, also return before the
+    // first token at or after stop, and before the end tag of the bottom element.
+    template <Flag F, bool Bounded, typename H>
+    void parseContent(H& handler, const char* stop) {
+        
+        char* name;
+        std::size_t nameLength;
+        while(true) {
             
-        } else {
+            // Parse text
+            if(F & Flag::TrimSpace) skip<F, Impl::Space>();
+            if(at<F>() != '<') parseText<F>(handler);
+            if(failed<F>()) return;
+            if(Bounded && (p >= stop || (stack.size() == 1 && at<F>(1) == '/'))) return;
             
-            *p = 0;
             ++p;
-            handler.startElement(name, nameLength);
-            Impl::Skipper<Impl::Space>::skip(p);
-            while(Table<Mapper<Impl::AttributeName, Index<unsigned char, 0, 255>>>::get(*p)) {
-                
-                // Parse attribute name
-                auto name = p;
-                std::size_t nameLength = Impl::Skipper<Impl::AttributeName>::skip(p);
-                if(!nameLength) throw Exception(p - s, "expected attribute name");
-                auto nameEnd = p;
-                Impl::Skipper<Impl::Space>::skip(p);
-                if(*p != '=') throw Exception(p - s, "expected =");
-                *nameEnd = 0;
+            switch(at<F>()) {
+                
+            case '!': {
+                
                 ++p;
-                Impl::Skipper<Impl::Space>::skip(p);
+                parseContentMarkup<F>(handler);
+                if(failed<F>()) return;
+                break;
                 
-                // Parse attribute value
-                if(*p == '"') {
-                    
-                    ++p;
-                    auto value = p;
-                    std::size_t valueLength;
-                    if(F & Flag::EntityTranslation) {
-                        
-                        auto q = p;
-                        while(true) {
-                            
-                            auto len = Impl::Skipper<Impl::AttributeValueNoRef1>::skip(p);
-                            if(*p == 0) throw Exception(p - s, "unexpected end");
-                            if(p != q + len) std::copy(q, q + len, p - len);
-                            q += len;
-                            if(*p == '&') parseReference<F>(q);
-                            else break;
-                            
-                        }
-                        *q = 0;
-                        valueLength = q - value;
-                        
-                    } else {
-                        
-                        valueLength = Impl::Skipper<Impl::AttributeValue1>::skip(p);
-                        if(*p == 0) throw Exception(p - s, "unexpected end");
-                        *p = 0;
-                        
-                    }
-                    ++p;
-                    handler.attribute(name, nameLength, value, valueLength);
-                    
-                } else if(*p == '\'') {
-                    
-                    ++p;
-                    auto value = p;
-                    std::size_t valueLength;
-                    if(F & Flag::EntityTranslation) {
-                        
-                        auto q = p;
-                        while(true) {
-                            
-                            auto len = Impl::Skipper<Impl::AttributeValueNoRef2>::skip(p);
-                            if(*p == 0) throw Exception(p - s, "unexpected end");
-                            if(p != q + len) std::copy(q, q + len, p - len);
-                            q += len;
-                            if(*p == '&') parseReference<F>(q);
-                            else break;
-                            
-                        }
-                        *q = 0;
-                        valueLength = q - value;
-                        
-                    } else {
-                        
-                        valueLength = Impl::Skipper<Impl::AttributeValue2>::skip(p);
-                        if(*p == 0) throw Exception(p - s, "unexpected end");
-                        *p = 0;
-                        
-                    }
-                    ++p;
-                    handler.attribute(name, nameLength, value, valueLength);
-                    
-                } else throw Exception(p - s, "expected \" or '");
-                Impl::Skipper<Impl::Space>::skip(p);
+            }
+            case '/': {
+                
+                ++p;
+                auto& top = stack.back();
+                parseEndTag<F>(handler, top.name, top.nameLength);
+                if(failed<F>()) return;
+                stack.pop_back();
+                if(stack.empty()) return;
+                break;
                 
             }
-            if(*p == '>') {
+            case '?': {
                 
                 ++p;
+                parseProcessingInstruction<F>(handler);
+                if(failed<F>()) return;
+                break;
                 
-            } else if(*p == '/') {
+            }
+            default: {
                 
-                if(p[1] != '>') throw Exception(p + 1 - s, "expected >");
-                p += 2;
-                empty = true;
+                if(stack.size() >= maxDepth) return fail<F>(p - s, "too deep");
+                countDepth<F>(stack.size() + 1);
+                bool empty = parseStartTag<F>(handler, name, nameLength);
+                if(failed<F>()) return;
+                if(empty) handler.endElement(name, nameLength);
+                else stack.push_back({name, nameLength});
+                break;
                 
-            } else throw Exception(p + 1 - s, "unexpected character");
+            }
+            
+            }
+            
+        }
+        
+    }
+    template <Flag F, typename H>
+    void parseProlog(H& handler) {
+        
+        stack.reserve(64);
+        handler.startDocument();
+        
+        // Parse BOM
+        if(match<F>("\xEF\xBB\xBF")) {
+            
+            p += 3;
             
         }
-        handler.endAttributes();
-        if(!empty) {
+        
+        // Parse XML declaration
+        if(match<F>("<?xml") && isSpace(at<F>(5))) {
             
-            bool c = true;
-            do {
-                
-                // Parse text
-                if(F & Flag::TrimSpace) Impl::Skipper<Impl::Space>::skip(p);
-                if(*p != '<') {
-                    
-                    if(F & Flag::EntityTranslation) {
-                        
-                        if(F & Flag::NormalizeSpace) {
-                            
-                            auto text = p;
-                            auto q = p;
-                            while(true) {
-                                
-                                auto len = Impl::Skipper<Impl::TextNoSpaceRef>::skip(p);
-                                if(*p == 0) throw Exception(p - s, "unexpected end");
-                                if(p != q + len) std::copy(p - len, p, q);
-                                q += len;
-                                if(*p == '&') parseReference<F>(q);
-                                else if(*p != '<') { Impl::Skipper<Impl::Space>::skip(p); *(q++) = ' '; }
-                                else break;
-                                
-                            }
-                            if(F & Flag::TrimSpace && q[-1] == ' ') --q;
-                            *q = 0;
-                            std::size_t textLength = q - text;
-                            handler.text(text, textLength);
-                            
-                        } else {
-                            
-                            auto text = p;
-                            auto q = p;
-                            while(true) {
-                                
-                                auto len = Impl::Skipper<Impl::TextNoRef>::skip(p);
-                                if(*p == 0) throw Exception(p - s, "unexpected end");
-                                if(p != q + len) std::copy(p - len, p, q);
-                                q += len;
-                                if(*p == '&') parseReference<F>(q);
-                                else break;
-                                
-                            }
-                            --q;
-                            if(F & Flag::TrimSpace)
-                                for(; Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(*q); --q);
-                            ++q;
-                            *q = 0;
-                            std::size_t textLength = q - text;
-                            handler.text(text, textLength);
-                            
-                        }
-                        
-                    } else {
-                        
-                        if(F & Flag::NormalizeSpace) {
-                                
-                            auto text = p;
-                            auto q = p;
-                            while(true) {
-                                
-                                auto len = Impl::Skipper<Impl::TextNoSpace>::skip(p);
-                                if(*p == 0) throw Exception(p - s, "unexpected end");
-                                if(p != q + len) std::copy(p - len, p, q);
-                                q += len;
-                                if(*p != '<') { Impl::Skipper<Impl::Space>::skip(p); *(q++) = ' '; }
-                                else break;
-                                
-                            }
-                            --q;
-                            if(F & Flag::TrimSpace)
-                                for(; Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(*q); --q);
-                            ++q;
-                            *q = 0;
-                            std::size_t textLength = q - text;
-                            handler.text(text, textLength);
-                            
-                        } else {
-                            
-                            auto text = p;
-                            Impl::Skipper<Impl::Text>::skip(p);
-                            if(*p == 0) throw Exception(p - s, "unexpected end");
-                            auto q = p - 1;
-                            if(F & Flag::TrimSpace)
-                                for(; Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(*q); --q);
-                            ++q;
-                            *q = 0;
-                            std::size_t textLength = q - text;
-                            handler.text(text, textLength);
-                            
-                        }
-                        
-                    }
-                    
-                }
+            // "<?xml "
+            p += 6;
+            parseXMLDeclaration<F>(handler);
+            
+        }
+        
+    }
+    // Parse the markup outside elements. When Head, return true before the name of the first element instead
+    // of parsing it.
+    template <Flag F, bool Head, typename H>
+    bool parseTopLevel(H& handler) {
+        
+        while(true) {
+            
+            skip<F, Impl::Space>();
+            if(end<F>()) break;
+            else if(at<F>() == '<') {
                 
                 ++p;
-                switch(*p) {
-                    
-                case '!': {
+                if(at<F>() == '!') {
                     
                     ++p;
-                    if(p[0] == '-' && p[1] == '-') {
+                    if(match<F>("--")) {
                         
                         p += 2;
                         parseComment<F>(handler);
                         
-                    } else if(p[0] == '[' && p[1] == 'C' && p[2] == 'D' && p[3] == 'A' && p[4] == 'T' && p[5] == 'A' && p[6] == '[') {
+                    } else if(match<F>("DOCTYPE")) {
                         
-                        // "[CDATA["
+                        // "DOCTYPE"
                         p += 7;
-                        parseCDATA<F>(handler);
-                        
-                    } else throw Exception(p - s, "unexpected character");
-                    break;
-                    
-                }
-                case '/': {
-                    
-                    ++p;
-                    if(F & Flag::ClosingTagValidate) {
-                    
-                    auto endName = p;
-                    Impl::Skipper<Impl::Name>::skip(p);
-                    auto endNameEnd = p;
-                    Impl::Skipper<Impl::Space>::skip(p);
-                    if(*p != '>') throw Exception(p - s, "expected >");
-                    *endNameEnd = 0;
-                    ++p;
-                    handler.endElement(endName, endNameEnd - endName);
-                        
-                    } else {
-                        
-                        if(!compare(p, name, nameLength)) throw Exception(p - s, "unmatch element type");
-                        auto endName = p;
-                        p += nameLength;
-                        auto endNameEnd = p;
-                        Impl::Skipper<Impl::Space>::skip(p);
-                        if(*p != '>') throw Exception(p - s, "expected >");
-                        *endNameEnd = 0;
-                        ++p;
-                        handler.endElement(endName, nameLength);
+                        parseDoctype<F>(handler);
                         
-                    }
-                    c = false;
-                    break;
+                    } else return fail<F>(p - s, "unexpected character"), false;
                     
-                }
-                case '?': {
+                } else if(at<F>() == '?') {
                     
                     ++p;
                     parseProcessingInstruction<F>(handler);
-                    break;
                     
-                }
-                default: {
+                } else {
                     
+                    if(!maxDepth) return fail<F>(p - s, "too deep"), false;
+                    if(Head) return true;
                     parseElement<F>(handler);
-                    break;
                     
                 }
+                if(failed<F>()) return false;
                 
-                }
+            } else return fail<F>(p - s, "expected <"), false;
+            
+        }
+        return false;
+        
+    }
+    template <Flag F, typename H>
+    void parseDocument(H& handler) {
+        
+        parseProlog<F>(handler);
+        if(failed<F>()) return;
+        parseTopLevel<F, false>(handler);
+        if(failed<F>()) return;
+        handler.endDocument();
+        
+    }
+    
+    // Parse a complete token in push mode, text tokens end with the following '<'
+    template <Flag F, typename H>
+    void parseToken(const char* begin, const char* end, H& handler) {
+        
+        s = const_cast<char*>(begin);
+        p = s;
+        e = const_cast<char*>(end);
+        bool top = nameLengths.empty();
+        if(skipDepth) {
+            
+            // Tokens in a skipped content are only balanced
+            if(*p != '<' || p[1] == '!' || p[1] == '?') return;
+            if(p[1] != '/') { skipDepth += e[-2] != '/'; return; }
+            if(--skipDepth) return;
+            
+        }
+        if(*p != '<') {
+            
+            // Parse BOM
+            bool bom = !position && match<F>("\xEF\xBB\xBF");
+            if(bom) p += 3;
+            declaration = bom && e - p == 1;
+            if(top) {
                 
-            } while(c);
+                skip<F, Impl::Space>();
+                if(at<F>() != '<') throw Exception(p - s, "expected <");
+                
+            } else {
+                
+                if(F & Flag::TrimSpace) skip<F, Impl::Space>();
+                if(at<F>() != '<') parseText<F>(handler);
+                
+            }
+            return;
+            
+        }
+        bool xml = declaration;
+        declaration = false;
+        ++p;
+        if(at<F>() == '!') {
+            
+            ++p;
+            if(!top) {
+                
+                parseContentMarkup<F>(handler);
+                
+            } else if(match<F>("--")) {
+                
+                p += 2;
+                parseComment<F>(handler);
+                
+            } else if(match<F>("DOCTYPE")) {
+                
+                // "DOCTYPE"
+                p += 7;
+                parseDoctype<F>(handler);
+                
+            } else throw Exception(p - s, "unexpected character");
+            
+        } else if(at<F>() == '?') {
+            
+            if(xml && match<F>("?xml") && isSpace(at<F>(4))) {
+                
+                // "?xml "
+                p += 5;
+                parseXMLDeclaration<F>(handler);
+                
+            } else {
+                
+                ++p;
+                parseProcessingInstruction<F>(handler);
+                
+            }
+            
+        } else if(at<F>() == '/' && !top) {
+            
+            ++p;
+            std::size_t nameLength = nameLengths.back();
+            parseEndTag<F>(handler, names.data() + names.size() - nameLength, nameLength);
+            names.resize(names.size() - nameLength);
+            nameLengths.pop_back();
+            
+        } else {
+            
+            if(nameLengths.size() >= maxDepth) throw Exception(p - s, "too deep");
+            char* name;
+            std::size_t nameLength;
+            countDepth<F>(nameLengths.size() + 1);
+            if(parseStartTag<F, true>(handler, name, nameLength)) {
+                
+                handler.endElement(name, nameLength);
+                
+            } else {
+                
+                // The token does not outlive this call, so the type is kept for the end tag
+                names.insert(names.end(), name, name + nameLength);
+                nameLengths.push_back(nameLength);
+                
+            }
             
-        } else handler.endElement(name, nameLength);
+        }
+        if(p != e) throw Exception(p - s, "unexpected character");
+        
+    }
+    void reset() {
+        
+        scanner.reset();
+        carry.clear();
+        names.clear();
+        nameLengths.clear();
+        position = 0;
+        skipDepth = 0;
+        started = false;
+        declaration = true;
+        stopped = false;
+        indexed = false;
         
     }
     
 public:
     
-    Parser() = default;
+    static constexpr std::size_t DEFAULT_ENTITY_EXPANSION_FACTOR = 16;
+    static constexpr std::size_t MIN_ENTITY_EXPANSION = 1 << 20;
+    
+    Parser() : s(), p(), e(), stack(), maxDepth(std::numeric_limits<std::size_t>::max()), buffer(), entities(),
+        maxEntityExpansion(), expansion(), inputSize(), index(), indexed(), scanner(), carry(), names(), nameLengths(), position(), skipDepth(), started(), declaration(true),
+        stopped(), statistics(), error(), errorPosition(), aborted() {}
     
     template <Flag F, typename H>
     void parse(char* data, H& handler) {
         
-        using namespace Corecat::Sequence;
+        static_assert(!(F & Flag::NonDestructive), "NonDestructive mode needs the size of the input");
         
         assert(data);
         
         s = data;
         p = data;
-        handler.startDocument();
+        e = nullptr;
+        indexed = F & Flag::StructuralIndex;
+        if(indexed) index.build(data, std::strlen(data));
+        statistics = Statistics();
+        entities.clear();
+        expansion = 0;
+        inputSize = 0;
+        try { parseDocument<F>(handler); } catch(Stopped&) {}
         
-        // Parse BOM
-        if(static_cast<unsigned char>(p[0]) == 0xEF &&
-            static_cast<unsigned char>(p[1]) == 0xBB &&
-            static_cast<unsigned char>(p[2]) == 0xBF) {
-            
-            p += 3;
-            
-        }
+    }
+    // The input is never written and need not be NUL-terminated. Names and values point into the input,
+    // except translated values pointing into a buffer that is reused after the callback returns.
+    template <Flag F, typename H>
+    void parse(const char* data, std::size_t size, H& handler) {
         
-        // Parse XML declaration
-        if(p[0] == '<' && p[1] == '?' && p[2] == 'x' && p[3] == 'm' && p[4] == 'l' && Table<Mapper<Impl::Space, Index<unsigned char, 0, 255>>>::get(p[5])) {
+        static_assert(F & Flag::NonDestructive, "writable input should use in-situ mode");
+        
+        assert(data || !size);
+        
+        s = const_cast<char*>(data);
+        p = s;
+        e = s + size;
+        indexed = F & Flag::StructuralIndex;
+        if(indexed) index.build(data, size);
+        statistics = Statistics();
+        entities.clear();
+        expansion = 0;
+        inputSize = size;
+        try { parseDocument<F>(handler); } catch(Stopped&) {}
+        
+    }
+    // Like parse, but a malformed document is reported in the result instead of thrown, so that rejecting it
+    // costs no unwinding. Exceptions thrown by the handler still propagate.
+    template <Flag F, typename H>
+    Result tryParse(char* data, H& handler) {
+        
+        static_assert(!(F & Flag::NonDestructive), "NonDestructive mode needs the size of the input");
+        
+        assert(data);
+        
+        s = data;
+        p = data;
+        e = nullptr;
+        indexed = F & Flag::StructuralIndex;
+        if(indexed) index.build(data, std::strlen(data));
+        statistics = Statistics();
+        entities.clear();
+        expansion = 0;
+        inputSize = 0;
+        error = nullptr;
+        aborted = false;
+        parseDocument<F | NO_THROW>(handler);
+        return {error, errorPosition};
+        
+    }
+    template <Flag F, typename H>
+    Result tryParse(const char* data, std::size_t size, H& handler) {
+        
+        static_assert(F & Flag::NonDestructive, "writable input should use in-situ mode");
+        
+        assert(data || !size);
+        
+        s = const_cast<char*>(data);
+        p = s;
+        e = s + size;
+        indexed = F & Flag::StructuralIndex;
+        if(indexed) index.build(data, size);
+        statistics = Statistics();
+        entities.clear();
+        expansion = 0;
+        inputSize = size;
+        error = nullptr;
+        aborted = false;
+        parseDocument<F | NO_THROW>(handler);
+        return {error, errorPosition};
+        
+    }
+    // Compute the location of an error position in the input. It is exact on the input as it was passed, an
+    // in-situ parse may have overwritten line ends before the position.
+    static Location getLocation(const char* data, std::size_t position) {
+        
+        const char* q = data;
+        const char* end = data + position;
+        std::size_t line = 1;
+        while(auto t = static_cast<const char*>(std::memchr(q, '\n', end - q))) ++line, q = t + 1;
+        return {line, static_cast<std::size_t>(end - q) + 1};
+        
+    }
+    
+    // Push mode: the document arrives in chunks of any size, and only a token that crosses a chunk boundary is
+    // copied. The input is never written, and the pointers passed to the handler are only valid during the
+    // callback. After Directive::Stop the rest of the input is ignored up to finish, which then does not call
+    // endDocument.
+    template <Flag F, typename H>
+    void feed(const char* data, std::size_t size, H& handler) {
+        
+        constexpr Flag G = F | Flag::NonDestructive;
+        
+        assert(data || !size);
+        
+        if(!started) {
             
-            // "<?xml "
-            p += 6;
-            parseXMLDeclaration<F>(handler);
+            reset();
+            started = true;
+            statistics = Statistics();
+            entities.clear();
+            expansion = 0;
+            handler.startDocument();
             
         }
-        while(true) {
+        if(stopped) return;
+        inputSize = position + carry.size() + size;
+        try {
             
-            Impl::Skipper<Impl::Space>::skip(p);
-            if(!*p) break;
-            else if(*p == '<') {
+            const char* b = data;
+            const char* end = data + size;
+            while(b != end) {
                 
-                ++p;
-                if(*p == '!') {
+                auto t = scanner.scan(b, end);
+                if(!t) {
                     
-                    ++p;
-                    if(p[0] == '-' && p[1] == '-') {
-                        
-                        p += 2;
-                        parseComment<F>(handler);
-                        
-                    } else if(p[0] == 'D' && p[1] == 'O' && p[2] == 'C' && p[3] == 'T' && p[4] == 'Y' && p[5] == 'P' && p[6] == 'E') {
-                        
-                        // "DOCTYPE"
-                        p += 7;
-                        parseDoctype<F>(handler);
-                        
-                    } else throw Exception(p - s, "unexpected character");
+                    carry.insert(carry.end(), b, end);
+                    break;
                     
-                } else if(*p == '?') {
+                }
+                std::size_t length = carry.size() + (t - b);
+                const char* tokenEnd = scanner.isText() ? t + 1 : t;
+                if(carry.empty()) {
                     
-                    ++p;
-                    parseProcessingInstruction<F>(handler);
+                    parseToken<G>(b, tokenEnd, handler);
                     
                 } else {
                     
-                    parseElement<F>(handler);
+                    carry.insert(carry.end(), b, tokenEnd);
+                    parseToken<G>(carry.data(), carry.data() + carry.size(), handler);
+                    carry.clear();
                     
                 }
+                scanner.reset();
+                position += length;
+                b = t;
                 
-            } else throw Exception(p - s, "expected <");
+            }
+            
+        } catch(Stopped&) {
+            
+            stopped = true;
+            
+        } catch(Exception& ex) {
+            
+            std::size_t pos = position + ex.getPosition();
+            reset();
+            throw Exception(pos, ex.what());
+            
+        } catch(...) {
+            
+            reset();
+            throw;
             
         }
         
+    }
+    template <Flag F, typename H>
+    void finish(H& handler) {
+        
+        constexpr Flag G = F | Flag::NonDestructive;
+        
+        if(!started) handler.startDocument();
+        if(stopped) { reset(); return; }
+        if(!scanner.empty()) {
+            
+            // Only spaces may follow the root element
+            s = carry.data();
+            p = s;
+            e = s + carry.size();
+            if(!position && match<G>("\xEF\xBB\xBF")) p += 3;
+            bool text = scanner.isText() && nameLengths.empty();
+            if(text) skip<G, Impl::Space>();
+            if(p != e) {
+                
+                std::size_t pos = position + (text ? p - s : carry.size());
+                const char* str = text ? "expected <" : "unexpected end";
+                reset();
+                throw Exception(pos, str);
+                
+            }
+            
+        }
+        if(!nameLengths.empty()) {
+            
+            std::size_t pos = position + carry.size();
+            reset();
+            throw Exception(pos, "unexpected end");
+            
+        }
+        reset();
         handler.endDocument();
         
     }
     
+    // Documents nested deeper than the limit are rejected
+    std::size_t getMaxDepth() const { return maxDepth; }
+    void setMaxDepth(std::size_t maxDepth_) { maxDepth = maxDepth_; }
+    // With Flag::InternalEntities, a parse is rejected once the replacements of declared entities, in entity
+    // values and in the content, add up to more than this many bytes. 0 is the default limit of
+    // DEFAULT_ENTITY_EXPANSION_FACTOR times the input size, and at least MIN_ENTITY_EXPANSION.
+    std::size_t getMaxEntityExpansion() const { return maxEntityExpansion; }
+    void setMaxEntityExpansion(std::size_t maxEntityExpansion_) { maxEntityExpansion = maxEntityExpansion_; }
+    
+    const Statistics& getStatistics() const { return statistics; }
+    
+    // Whether a value passed to the handler has been translated into the buffer
+    bool isBuffered(const char* data) const {
+        
+        return data >= buffer.data() && data < buffer.data() + buffer.size();
+        
+    }
+    
 };
 
 }
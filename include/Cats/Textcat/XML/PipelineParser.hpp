@@ -0,0 +1,264 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_PIPELINEPARSER_HPP
+#define CATS_TEXTCAT_XML_PIPELINEPARSER_HPP
+
+
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include "EventBuffer.hpp"
+#include "Handler.hpp"
+#include "Parser.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Tokenizes on a worker thread while the handler runs on the calling thread. The worker records events into
+// batches of a single-producer single-consumer ring of EventBuffers, which the calling thread replays and
+// hands back, so the memory in flight is bounded by the number and size of the batches.
+class PipelineParser {
+    
+private:
+    
+    struct Ring {
+        
+        std::unique_ptr<EventBuffer[]> batches;
+        std::size_t count;
+        // Batches published by the worker and replayed by the handler, counted from the start
+        std::atomic<std::size_t> tail;
+        std::atomic<std::size_t> head;
+        std::atomic<bool> done;
+        std::atomic<bool> cancelled;
+        std::exception_ptr error;
+        
+        Ring(std::size_t count_) : batches(new EventBuffer[count_]), count(count_), tail(0), head(0), done(false),
+            cancelled(false), error() {}
+        
+    };
+    
+    // Thrown on the worker when the handler has failed
+    struct Cancelled {};
+    
+    // Records the callbacks that H uses and publishes a batch once it holds batchSize events
+    template <typename H>
+    class Producer : public HandlerBase {
+        
+    private:
+        
+        Ring* ring;
+        const Parser* parser;
+        std::size_t batchSize;
+        std::size_t tail;
+        EventBuffer::Recorder recorder;
+        
+    private:
+        
+        EventBuffer& current() { return ring->batches[tail % ring->count]; }
+        void event() { if(current().size() >= batchSize) publish(); }
+        
+    public:
+        
+        static constexpr Callback CALLBACKS = Impl::Callbacks<H>::value;
+        
+        Producer(Ring* ring_, const Parser* parser_, std::size_t batchSize_) : ring(ring_), parser(parser_),
+            batchSize(batchSize_), tail(0), recorder(&ring->batches[0], parser) {}
+        
+        // Hand the current batch to the handler without taking a new one
+        void finish() { if(!current().empty()) ring->tail.store(++tail, std::memory_order_release); }
+        void publish() {
+            
+            if(ring->cancelled.load(std::memory_order_relaxed)) throw Cancelled();
+            if(current().empty()) return;
+            finish();
+            while(tail - ring->head.load(std::memory_order_acquire) == ring->count) {
+                
+                if(ring->cancelled.load(std::memory_order_relaxed)) throw Cancelled();
+                std::this_thread::yield();
+                
+            }
+            recorder = EventBuffer::Recorder(&current(), parser);
+            
+        }
+        
+        void startDocument() { recorder.startDocument(); }
+        void endDocument() { recorder.endDocument(); }
+        void startElement(const char* name, std::size_t nameLength) { recorder.startElement(name, nameLength); event(); }
+        void endElement(const char* name, std::size_t nameLength) { recorder.endElement(name, nameLength); event(); }
+        void endAttributes() { recorder.endAttributes(); }
+        void doctype(const char* name, std::size_t nameLength, const char* publicId, std::size_t publicIdLength,
+            const char* systemId, std::size_t systemIdLength, const char* internalSubset, std::size_t internalSubsetLength) {
+            
+            recorder.doctype(name, nameLength, publicId, publicIdLength, systemId, systemIdLength, internalSubset, internalSubsetLength);
+            
+        }
+        void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            recorder.attribute(name, nameLength, value, valueLength);
+            
+        }
+        void text(const char* value, std::size_t valueLength) { recorder.text(value, valueLength); event(); }
+        void cdata(const char* value, std::size_t valueLength) { recorder.cdata(value, valueLength); event(); }
+        void comment(const char* value, std::size_t valueLength) { recorder.comment(value, valueLength); event(); }
+        void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+            
+            recorder.processingInstruction(name, nameLength, value, valueLength);
+            event();
+            
+        }
+        
+    };
+    
+private:
+    
+    std::size_t batchCount;
+    std::size_t batchSize;
+    std::size_t maxDepth;
+    
+private:
+    
+    // Run parse(parser, producer) on a worker and replay its batches into handler
+    template <typename H, typename P>
+    void run(H& handler, P parse) {
+        
+        Ring ring(batchCount);
+        std::thread worker([&] {
+            
+            Parser parser;
+            parser.setMaxDepth(maxDepth);
+            Producer<H> producer(&ring, &parser, batchSize);
+            try {
+                
+                parse(parser, producer);
+                producer.finish();
+                
+            } catch(Cancelled&) {
+            } catch(Parser::Exception&) {
+                
+                // The events before the error are complete
+                producer.finish();
+                ring.error = std::current_exception();
+                
+            } catch(...) {
+                
+                ring.error = std::current_exception();
+                
+            }
+            ring.done.store(true, std::memory_order_release);
+            
+        });
+        struct Join {
+            
+            Ring& ring;
+            std::thread& worker;
+            ~Join() { ring.cancelled.store(true); worker.join(); }
+            
+        } join{ring, worker};
+        std::size_t head = 0;
+        while(true) {
+            
+            if(head == ring.tail.load(std::memory_order_acquire)) {
+                
+                if(ring.done.load(std::memory_order_acquire) && head == ring.tail.load(std::memory_order_acquire)) break;
+                std::this_thread::yield();
+                continue;
+                
+            }
+            auto& batch = ring.batches[head % ring.count];
+            batch.replay(handler);
+            batch.clear();
+            ring.head.store(++head, std::memory_order_release);
+            
+        }
+        if(ring.error) std::rethrow_exception(ring.error);
+        
+    }
+    
+public:
+    
+    static constexpr std::size_t DEFAULT_BATCH_COUNT = 8;
+    static constexpr std::size_t DEFAULT_BATCH_SIZE = 4096;
+    
+    PipelineParser() : batchCount(DEFAULT_BATCH_COUNT), batchSize(DEFAULT_BATCH_SIZE),
+        maxDepth(std::numeric_limits<std::size_t>::max()) {}
+    PipelineParser(const PipelineParser& src) = delete;
+    
+    // Batches in the ring, and events per batch
+    std::size_t getBatchCount() const { return batchCount; }
+    void setBatchCount(std::size_t batchCount_) { batchCount = std::max<std::size_t>(batchCount_, 1); }
+    std::size_t getBatchSize() const { return batchSize; }
+    void setBatchSize(std::size_t batchSize_) { batchSize = std::max<std::size_t>(batchSize_, 1); }
+    std::size_t getMaxDepth() const { return maxDepth; }
+    void setMaxDepth(std::size_t maxDepth_) { maxDepth = maxDepth_; }
+    
+    // A parse error is thrown after the handler has received the events before it, and an exception thrown by
+    // the handler stops the worker. Handlers returning directives are run by a plain Parser on this thread.
+    template <Parser::Flag F, typename H>
+    void parse(char* data, H& handler) {
+        
+        if(Impl::HasDirective<H>::value) {
+            
+            Parser parser;
+            parser.setMaxDepth(maxDepth);
+            parser.parse<F>(data, handler);
+            return;
+            
+        }
+        run(handler, [data](Parser& parser, Producer<H>& producer) { parser.parse<F>(data, producer); });
+        
+    }
+    template <Parser::Flag F, typename H>
+    void parse(const char* data, std::size_t size, H& handler) {
+        
+        if(Impl::HasDirective<H>::value) {
+            
+            Parser parser;
+            parser.setMaxDepth(maxDepth);
+            parser.parse<F>(data, size, handler);
+            return;
+            
+        }
+        run(handler, [data, size](Parser& parser, Producer<H>& producer) { parser.parse<F>(data, size, producer); });
+        
+    }
+    
+};
+
+}
+}
+}
+
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+ 
+#ifndef CATS_TEXTCAT_XML_QUERY_HPP
+#define CATS_TEXTCAT_XML_QUERY_HPP
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Handler.hpp"
+#include "Parser.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+template <typename M>
+class QueryHandler;
+
+// A path over the elements of a document, compiled for matching during parsing. The supported subset of XPath
+// is child (/) and descendant (//) steps, names or *, and predicates [@name] or [@name='value'] on steps. A
+// path selects the elements of its last step, or ends with /@name for their attribute or with /text() for their
+// text and CDATA sections.
+class Query {
+    
+    template <typename A>
+    friend class BasicDocument;
+    template <typename M>
+    friend class QueryHandler;
+    
+public:
+    
+    enum class Target {
+        
+        Element,
+        Attribute,
+        Text,
+        
+    };
+    
+    class Exception : public std::exception {
+        
+    private:
+        
+        std::size_t pos;
+        const char* str;
+        
+    public:
+        
+        Exception(std::size_t pos_, const char* str_) : pos(pos_), str(str_) {}
+        Exception(const Exception& src) : pos(src.pos), str(src.str) {}
+        
+        const char* what() const noexcept final { return str; }
+        std::size_t getPosition() const { return pos; }
+        
+    };
+    
+    // Steps and predicates are kept in bit sets
+    enum : std::size_t { MAX_STEPS = 63, MAX_PREDICATES = 64 };
+    
+private:
+    
+    struct Step {
+        
+        std::string name;
+        bool any;
+        std::uint64_t predicates;
+        
+    };
+    struct Predicate {
+        
+        std::string name;
+        std::string value;
+        bool hasValue;
+        std::size_t step;
+        
+    };
+    
+    std::vector<Step> steps;
+    std::vector<Predicate> predicates;
+    std::uint64_t descendants;
+    Target target;
+    std::string attribute;
+    
+private:
+    
+    static bool equal(const std::string& a, const char* data, std::size_t length) {
+        
+        return a.size() == length && !std::memcmp(a.data(), data, length);
+        
+    }
+    bool test(std::size_t i, const char* name, std::size_t nameLength) const {
+        
+        return steps[i].any || equal(steps[i].name, name, nameLength);
+        
+    }
+    
+    static std::size_t name(const char* path, std::size_t length, std::size_t pos) {
+        
+        auto begin = pos;
+        while(pos < length && !std::strchr("/[]=@'\"", path[pos])) ++pos;
+        if(pos == begin) throw Exception(pos, "expected name");
+        return pos;
+        
+    }
+    void compile(const char* path, std::size_t length) {
+        
+        std::size_t pos = 0;
+        if(!length || path[0] != '/') throw Exception(0, "expected /");
+        while(pos < length) {
+            
+            // Separator
+            bool descendant = pos + 1 < length && path[pos + 1] == '/';
+            pos += descendant ? 2 : 1;
+            
+            // "//@name" and "//text()" select from any element
+            bool last = pos < length && path[pos] == '@';
+            if(!last && length - pos == 6 && !std::memcmp(path + pos, "text()", 6)) last = true;
+            if(last && descendant) {
+                
+                if(steps.size() >= MAX_STEPS) throw Exception(pos, "too many steps");
+                descendants |= std::uint64_t(1) << steps.size();
+                steps.push_back({std::string(), true, 0});
+                
+            }
+            if(last && steps.empty()) throw Exception(pos, "expected name");
+            if(last && path[pos] == '@') {
+                
+                auto end = name(path, length, ++pos);
+                if(end != length) throw Exception(end, "unexpected character");
+                target = Target::Attribute;
+                attribute.assign(path + pos, end - pos);
+                return;
+                
+            } else if(last) {
+                
+                target = Target::Text;
+                return;
+                
+            }
+            
+            // Name test
+            if(steps.size() >= MAX_STEPS) throw Exception(pos, "too many steps");
+            if(descendant) descendants |= std::uint64_t(1) << steps.size();
+            bool any = pos < length && path[pos] == '*';
+            auto end = any ? pos + 1 : name(path, length, pos);
+            Step step = {std::string(path + pos, any ? 0 : end - pos), any, 0};
+            pos = end;
+            
+            // Predicates
+            while(pos < length && path[pos] == '[') {
+                
+                if(predicates.size() >= MAX_PREDICATES) throw Exception(pos, "too many predicates");
+                if(++pos == length || path[pos] != '@') throw Exception(pos, "expected @");
+                end = name(path, length, ++pos);
+                Predicate predicate = {std::string(path + pos, end - pos), std::string(), false, steps.size()};
+                pos = end;
+                if(pos < length && path[pos] == '=') {
+                    
+                    if(++pos == length || (path[pos] != '"' && path[pos] != '\'')) throw Exception(pos, "expected \" or '");
+                    auto quote = path[pos++];
+                    end = pos;
+                    while(end < length && path[end] != quote) ++end;
+                    if(end == length) throw Exception(end, "unexpected end");
+                    predicate.value.assign(path + pos, end - pos);
+                    predicate.hasValue = true;
+                    pos = end + 1;
+                    
+                }
+                if(pos == length || path[pos] != ']') throw Exception(pos, "expected ]");
+                ++pos;
+                step.predicates |= std::uint64_t(1) << predicates.size();
+                predicates.push_back(std::move(predicate));
+                
+            }
+            steps.push_back(std::move(step));
+            if(pos < length && path[pos] != '/') throw Exception(pos, "unexpected character");
+            
+        }
+        
+    }
+    
+public:
+    
+    Query(const char* path) : Query(path, std::strlen(path)) {}
+    Query(const char* path, std::size_t length) : steps(), predicates(), descendants(), target(Target::Element), attribute() {
+        
+        compile(path, length);
+        
+    }
+    
+    Target getTarget() const { return target; }
+    
+    // Call match(data, length) for each match in document order, see QueryHandler
+    template <Parser::Flag F, typename M>
+    void parse(char* data, M match) const;
+    template <Parser::Flag F, typename M>
+    void parse(const char* data, std::size_t size, M match) const;
+    
+};
+
+// Runs a query as a SAX handler, keeping the steps each open element may match. Matches are the names of the
+// selected elements, the attribute values or the texts. They point into the parsed input, or into a buffer
+// only valid during the call to match for values translated by a NonDestructive parser. Elements below which
+// nothing can match are skipped without parsing their content. The handler refers to the query, which has to
+// outlive it.
+template <typename M>
+class QueryHandler : public HandlerBase {
+    
+private:
+    
+    struct Level {
+        
+        // Steps that the children may match
+        std::uint64_t active;
+        bool text;
+        
+    };
+    
+    const Query* query;
+    M match;
+    std::vector<Level> stack;
+    
+    // The element whose attributes are being parsed
+    const char* name;
+    std::size_t nameLength;
+    std::uint64_t candidates;
+    std::uint64_t satisfied;
+    std::vector<char> pending;
+    bool hasPending;
+    bool selected;
+    
+private:
+    
+    std::uint64_t last() const { return std::uint64_t(1) << (query->steps.size() - 1); }
+    
+public:
+    
+    QueryHandler(const Query& query_, M match_) : query(&query_), match(match_), stack(), name(), nameLength(),
+        candidates(), satisfied(), pending(), hasPending(), selected() {}
+    QueryHandler(const Query&& query_, M match_) = delete;
+    
+    // Whether the last step may select the element whose attributes are being parsed, and whether it did once
+    // they have been parsed
+    bool isCandidate() const { return candidates & last(); }
+    bool isSelected() const { return selected; }
+    
+    void startDocument() { stack.assign(1, {1, false}); }
+    Directive startElement(const char* name_, std::size_t nameLength_) {
+        
+        auto active = stack.back().active;
+        name = name_;
+        nameLength = nameLength_;
+        candidates = 0;
+        for(std::size_t i = 0; i < query->steps.size(); ++i)
+            if(active & (std::uint64_t(1) << i) && query->test(i, name, nameLength)) candidates |= std::uint64_t(1) << i;
+        satisfied = 0;
+        hasPending = false;
+        selected = false;
+        // Descendant steps stay active below
+        stack.push_back({active & query->descendants, false});
+        return candidates || stack.back().active ? Directive::Continue : Directive::Skip;
+        
+    }
+    void endElement(const char* /*name*/, std::size_t /*nameLength*/) { stack.pop_back(); }
+    void attribute(const char* name_, std::size_t nameLength_, const char* value, std::size_t valueLength) {
+        
+        if(!candidates) return;
+        for(std::size_t j = 0; j < query->predicates.size(); ++j) {
+            
+            auto& predicate = query->predicates[j];
+            if(candidates & (std::uint64_t(1) << predicate.step) && Query::equal(predicate.name, name_, nameLength_) &&
+                (!predicate.hasValue || Query::equal(predicate.value, value, valueLength)))
+                satisfied |= std::uint64_t(1) << j;
+            
+        }
+        if(query->target == Query::Target::Attribute && candidates & last() && !hasPending &&
+            Query::equal(query->attribute, name_, nameLength_)) {
+            
+            // Predicates of the last step are only known at the end of the attributes
+            if(query->steps.back().predicates) { pending.assign(value, value + valueLength); hasPending = true; }
+            else match(value, valueLength);
+            
+        }
+        
+    }
+    Directive endAttributes() {
+        
+        auto& level = stack.back();
+        std::uint64_t matched = 0;
+        for(std::size_t i = 0; i < query->steps.size(); ++i) {
+            
+            auto mask = query->steps[i].predicates;
+            if(candidates & (std::uint64_t(1) << i) && (satisfied & mask) == mask) matched |= std::uint64_t(1) << i;
+            
+        }
+        candidates = 0;
+        level.active |= (matched & ~last()) << 1;
+        selected = matched & last();
+        if(selected) {
+            
+            switch(query->target) {
+                
+            case Query::Target::Element: match(name, nameLength); break;
+            case Query::Target::Attribute: if(hasPending) match(pending.data(), pending.size()); break;
+            case Query::Target::Text: level.text = true; break;
+                
+            }
+            
+        }
+        return level.active || level.text ? Directive::Continue : Directive::Skip;
+        
+    }
+    void text(const char* value, std::size_t valueLength) { if(stack.back().text) match(value, valueLength); }
+    void cdata(const char* value, std::size_t valueLength) { if(stack.back().text) match(value, valueLength); }
+    
+};
+
+template <Parser::Flag F, typename M>
+inline void Query::parse(char* data, M match) const {
+    
+    Parser parser;
+    QueryHandler<M> handler(*this, match);
+    parser.parse<F>(data, handler);
+    
+}
+template <Parser::Flag F, typename M>
+inline void Query::parse(const char* data, std::size_t size, M match) const {
+    
+    Parser parser;
+    QueryHandler<M> handler(*this, match);
+    parser.parse<F>(data, size, handler);
+    
+}
+
+}
+}
+}
+
+
+#endif
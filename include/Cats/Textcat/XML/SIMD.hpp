@@ -0,0 +1,181 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_SIMD_HPP
+#define CATS_TEXTCAT_XML_SIMD_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(CATS_TEXTCAT_XML_NO_SIMD)
+#   if defined(__AVX2__)
+#       define CATS_TEXTCAT_XML_SIMD_AVX2
+#   elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#       define CATS_TEXTCAT_XML_SIMD_SSE2
+#   elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#       define CATS_TEXTCAT_XML_SIMD_NEON
+#   endif
+#endif
+
+#if defined(CATS_TEXTCAT_XML_SIMD_AVX2)
+#   include <immintrin.h>
+#elif defined(CATS_TEXTCAT_XML_SIMD_SSE2)
+#   include <emmintrin.h>
+#elif defined(CATS_TEXTCAT_XML_SIMD_NEON)
+#   include <arm_neon.h>
+#endif
+
+#if defined(CATS_TEXTCAT_XML_SIMD_AVX2) || defined(CATS_TEXTCAT_XML_SIMD_SSE2) || defined(CATS_TEXTCAT_XML_SIMD_NEON)
+#   define CATS_TEXTCAT_XML_SIMD
+#   if defined(_MSC_VER) && !defined(__clang__)
+#       include <intrin.h>
+#   endif
+#endif
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+namespace Impl {
+
+#if defined(CATS_TEXTCAT_XML_SIMD)
+
+namespace SIMD {
+
+#if defined(CATS_TEXTCAT_XML_SIMD_AVX2)
+
+using Vector = __m256i;
+using Mask = std::uint32_t;
+
+// Number of bytes per vector and number of mask bits per byte
+constexpr std::size_t WIDTH = 32;
+constexpr std::size_t SCALE = 1;
+
+inline Vector load(const char* p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Vector loadUnaligned(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Vector set(unsigned char c) { return _mm256_set1_epi8(static_cast<char>(c)); }
+inline Vector equal(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vector either(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+inline Mask mask(Vector a) { return static_cast<Mask>(_mm256_movemask_epi8(a)); }
+
+#elif defined(CATS_TEXTCAT_XML_SIMD_SSE2)
+
+using Vector = __m128i;
+using Mask = std::uint32_t;
+
+constexpr std::size_t WIDTH = 16;
+constexpr std::size_t SCALE = 1;
+
+inline Vector load(const char* p) { return _mm_load_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Vector loadUnaligned(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Vector set(unsigned char c) { return _mm_set1_epi8(static_cast<char>(c)); }
+inline Vector equal(Vector a, Vector b) { return _mm_cmpeq_epi8(a, b); }
+inline Vector either(Vector a, Vector b) { return _mm_or_si128(a, b); }
+inline Mask mask(Vector a) { return static_cast<Mask>(_mm_movemask_epi8(a)); }
+
+#elif defined(CATS_TEXTCAT_XML_SIMD_NEON)
+
+using Vector = uint8x16_t;
+using Mask = std::uint64_t;
+
+// NEON has no movemask, so every byte is narrowed into a nibble of a 64-bit mask
+constexpr std::size_t WIDTH = 16;
+constexpr std::size_t SCALE = 4;
+
+inline Vector load(const char* p) { return vld1q_u8(reinterpret_cast<const std::uint8_t*>(p)); }
+inline Vector loadUnaligned(const char* p) { return vld1q_u8(reinterpret_cast<const std::uint8_t*>(p)); }
+inline Vector set(unsigned char c) { return vdupq_n_u8(c); }
+inline Vector equal(Vector a, Vector b) { return vceqq_u8(a, b); }
+inline Vector either(Vector a, Vector b) { return vorrq_u8(a, b); }
+inline Mask mask(Vector a) { return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(a), 4)), 0); }
+
+#endif
+
+constexpr Mask FULL = WIDTH * SCALE == sizeof(Mask) * 8 ? ~Mask() : (Mask(1) << (WIDTH * SCALE)) - 1;
+
+// Drop the mask bits of the first n bytes
+inline Mask shift(Mask m, std::size_t n) { return m >> (n * SCALE); }
+
+inline std::size_t countZero(std::uint32_t m) {
+    
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return i;
+#else
+    return __builtin_ctz(m);
+#endif
+    
+}
+#if defined(CATS_TEXTCAT_XML_SIMD_NEON)
+inline std::size_t countZero(std::uint64_t m) {
+    
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward64(&i, m);
+    return i;
+#else
+    return __builtin_ctzll(m);
+#endif
+    
+}
+#endif
+
+// Index of the first byte whose mask bits are set, m must not be 0
+inline std::size_t first(Mask m) { return countZero(m) / SCALE; }
+
+// Bytes of a vector that equal any of V...
+template <unsigned char... V>
+struct Any;
+
+template <unsigned char V>
+struct Any<V> {
+    
+    static Vector get(Vector t) { return equal(t, set(V)); }
+    
+};
+
+template <unsigned char V, unsigned char W, unsigned char... R>
+struct Any<V, W, R...> {
+    
+    static Vector get(Vector t) { return either(equal(t, set(V)), Any<W, R...>::get(t)); }
+    
+};
+
+}
+
+#endif
+
+}
+
+}
+}
+}
+
+
+#endif
@@ -29,20 +29,26 @@
 
 
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 #include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "Cats/Corecat/Stream.hpp"
 
 #include "Handler.hpp"
+#include "Skipper.hpp"
 
 
 namespace Cats {
 namespace Textcat{
 namespace XML {
 
-class Serializer : public HandlerBase {
+// Writes every token straight to the stream
+class StreamWriter {
     
 private:
     
@@ -50,80 +56,354 @@ private:
     
 public:
     
-    Serializer() = default;
-    Serializer(Corecat::Stream::Base& stream_) : stream(&stream_) { assert(stream->isWriteable()); }
+    StreamWriter() : stream() {}
+    StreamWriter(Corecat::Stream::Base& stream_) : stream(&stream_) { assert(stream->isWriteable()); }
     
     Corecat::Stream::Base& getStream() { return *stream; }
     void setStream(Corecat::Stream::Base& stream_) { stream = &stream_; }
     
-    void startDocument() {}
-    void endDocument() {}
+    void write(const char* data, std::size_t size) { stream->write(data, size); }
+    void flush() {}
+    
+};
+
+// Collects tokens in a buffer and writes them to the stream in large blocks
+class BufferedStreamWriter {
+    
+private:
+    
+    Corecat::Stream::Base* stream;
+    std::vector<char> buffer;
+    std::size_t size;
+    
+private:
+    
+    void writeSlow(const char* data, std::size_t size_) {
+        
+        flush();
+        if(size_ >= buffer.size()) stream->write(data, size_);
+        else { std::memcpy(buffer.data(), data, size_); size = size_; }
+        
+    }
+    
+public:
+    
+    static constexpr std::size_t DEFAULT_CAPACITY = 65536;
+    
+    BufferedStreamWriter(Corecat::Stream::Base& stream_, std::size_t capacity = DEFAULT_CAPACITY) :
+        stream(&stream_), buffer(capacity ? capacity : 1), size() { assert(stream->isWriteable()); }
+    BufferedStreamWriter(const BufferedStreamWriter& src) = delete;
+    BufferedStreamWriter(BufferedStreamWriter&& src) :
+        stream(src.stream), buffer(std::move(src.buffer)), size(src.size) { src.size = 0; }
+    ~BufferedStreamWriter() { flush(); }
+    
+    Corecat::Stream::Base& getStream() { return *stream; }
+    void setStream(Corecat::Stream::Base& stream_) { flush(); stream = &stream_; }
+    
+    void write(const char* data, std::size_t size_) {
+        
+        if(size_ <= buffer.size() - size) {
+            
+            std::memcpy(buffer.data() + size, data, size_);
+            size += size_;
+            
+        } else writeSlow(data, size_);
+        
+    }
+    void flush() {
+        
+        if(size) {
+            
+            stream->write(buffer.data(), size);
+            size = 0;
+            
+        }
+        
+    }
+    
+};
+
+// Appends to a caller-provided std::string or std::vector<char>
+template <typename C>
+class ContainerWriter {
+    
+private:
+    
+    C* container;
+    
+public:
+    
+    ContainerWriter(C& container_) : container(&container_) {}
+    
+    C& getContainer() { return *container; }
+    
+    void write(const char* data, std::size_t size) { container->insert(container->end(), data, data + size); }
+    void flush() {}
+    
+};
+
+namespace Impl {
+
+using EscapeText = Exclude<unsigned char, '&', '<', '>'>;
+using EscapeAttributeValue = Exclude<unsigned char, '"', '&', '<', '>'>;
+
+}
+
+class SerializerBase : public HandlerBase {
+    
+public:
+    
+    enum class Flag : std::uint32_t {
+        
+        None = 0x00000000,
+        Escape = 0x00000001,
+        Indent = 0x00000002,
+        
+        Default = None,
+        
+    };
+    friend constexpr bool operator &(Flag a, Flag b) {
+        
+        return static_cast<std::uint32_t>(a) & static_cast<std::uint32_t>(b);
+        
+    }
+    friend constexpr Flag operator |(Flag a, Flag b) {
+        
+        return static_cast<Flag>(static_cast<std::uint32_t>(a) | static_cast<std::uint32_t>(b));
+        
+    }
+    
+};
+
+template <typename W>
+class BasicSerializer : public SerializerBase {
+    
+private:
+    
+    W writer;
+    Flag flag;
+    
+    // Flag::Indent: a newline followed by indent units, of which each line writes a prefix
+    std::string newline;
+    std::string indent;
+    std::string whitespace;
+    std::vector<unsigned char> levels;
+    bool started;
+    
+private:
+    
+    enum : unsigned char { CHILDREN = 0x01, MIXED = 0x02 };
+    
+    void writeLine(std::size_t depth) {
+        
+        std::size_t size = newline.size() + depth * indent.size();
+        while(whitespace.size() < size) whitespace += indent;
+        writer.write(whitespace.data(), size);
+        
+    }
+    // Start a line for a node, except the first one of the document and in mixed content
+    void indentNode() {
+        
+        if(!(flag & Flag::Indent)) return;
+        if(levels.empty()) { if(started) writeLine(0); started = true; return; }
+        auto& level = levels.back();
+        if(level & MIXED) return;
+        level |= CHILDREN;
+        writeLine(levels.size());
+        
+    }
+    static bool isSpace(const char* data, std::size_t size) {
+        
+        for(const char* end = data + size; data != end; ++data)
+            if(*data != ' ' && *data != '\t' && *data != '\n' && *data != '\r') return false;
+        return true;
+        
+    }
+    
+    // Clean spans between the characters in Cond are written as one block
+    template <typename Cond>
+    void writeEscaped(const char* data, std::size_t size) {
+        
+        auto p = const_cast<char*>(data);
+        const char* e = data + size;
+        while(true) {
+            
+            auto t = p;
+            Impl::Skipper<Cond>::skip(p, e);
+            if(p != t) writer.write(t, p - t);
+            if(p == e) break;
+            switch(*p) {
+                
+            case '"': writer.write("&quot;", 6); break;
+            case '&': writer.write("&amp;", 5); break;
+            case '<': writer.write("&lt;", 4); break;
+            case '>': writer.write("&gt;", 4); break;
+            default: writer.write(p, 1); break;
+            
+            }
+            ++p;
+            
+        }
+        
+    }
+    
+    // A literal is quoted with apostrophes when it contains quotation marks
+    void writeLiteral(const char* data, std::size_t size) {
+        
+        const char* quote = std::memchr(data, '"', size) ? "'" : "\"";
+        writer.write(quote, 1);
+        writer.write(data, size);
+        writer.write(quote, 1);
+        
+    }
+    
+public:
+    
+    BasicSerializer() : writer(), flag(Flag::Default), newline("\n"), indent("    "), whitespace(newline), levels(), started() {}
+    BasicSerializer(W writer_, Flag flag_ = Flag::Default) :
+        writer(std::move(writer_)), flag(flag_), newline("\n"), indent("    "), whitespace(newline), levels(), started() {}
+    
+    W& getWriter() { return writer; }
+    
+    Flag getFlag() const { return flag; }
+    void setFlag(Flag flag_) { flag = flag_; }
+    
+    // Used with Flag::Indent, four spaces and "\n" by default
+    const std::string& getIndent() const { return indent; }
+    void setIndent(std::string indent_) { indent = std::move(indent_); whitespace = newline; }
+    const std::string& getNewline() const { return newline; }
+    void setNewline(std::string newline_) { newline = std::move(newline_); whitespace = newline; }
+    
+    Corecat::Stream::Base& getStream() { return writer.getStream(); }
+    void setStream(Corecat::Stream::Base& stream_) { writer.setStream(stream_); }
+    
+    void startDocument() { levels.clear(); started = false; }
+    void endDocument() {
+        
+        if(flag & Flag::Indent && started) writer.write(newline.data(), newline.size());
+        writer.flush();
+        
+    }
     void startElement(const char* name, std::size_t nameLength) {
         
-        stream->write("<", 1);
-        stream->write(name, nameLength);
+        indentNode();
+        writer.write("<", 1);
+        writer.write(name, nameLength);
+        if(flag & Flag::Indent) levels.push_back(!levels.empty() && levels.back() & MIXED ? MIXED : 0);
         
     }
     void startElement(const char* name) { startElement(name, std::strlen(name)); }
     void endElement(const char* name, std::size_t nameLength) {
         
-        stream->write("</", 2);
-        stream->write(name, nameLength);
-        stream->write(">", 1);
+        if(flag & Flag::Indent && !levels.empty()) {
+            
+            auto level = levels.back();
+            levels.pop_back();
+            if(level == CHILDREN) writeLine(levels.size());
+            
+        }
+        writer.write("</", 2);
+        writer.write(name, nameLength);
+        writer.write(">", 1);
         
     }
     void endElement(const char* name) { endElement(name, std::strlen(name)); }
     void endAttributes() {
         
-        stream->write(">", 1);
+        writer.write(">", 1);
+        
+    }
+    void doctype(const char* name, std::size_t nameLength, const char* publicId, std::size_t publicIdLength,
+        const char* systemId, std::size_t systemIdLength, const char* internalSubset, std::size_t internalSubsetLength) {
+        
+        indentNode();
+        writer.write("<!DOCTYPE ", 10);
+        writer.write(name, nameLength);
+        if(publicIdLength) {
+            
+            writer.write(" PUBLIC ", 8);
+            writeLiteral(publicId, publicIdLength);
+            writer.write(" ", 1);
+            writeLiteral(systemId, systemIdLength);
+            
+        } else if(systemIdLength) {
+            
+            writer.write(" SYSTEM ", 8);
+            writeLiteral(systemId, systemIdLength);
+            
+        }
+        if(internalSubsetLength) {
+            
+            writer.write(" [", 2);
+            writer.write(internalSubset, internalSubsetLength);
+            writer.write("]", 1);
+            
+        }
+        writer.write(">", 1);
         
     }
-    void doctype() {}
     void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
         
-        stream->write(" ", 1);
-        stream->write(name, nameLength);
-        stream->write("=\"", 2);
-        stream->write(value, valueLength);
-        stream->write("\"", 1);
+        writer.write(" ", 1);
+        writer.write(name, nameLength);
+        writer.write("=\"", 2);
+        if(flag & Flag::Escape) writeEscaped<Impl::EscapeAttributeValue>(value, valueLength);
+        else writer.write(value, valueLength);
+        writer.write("\"", 1);
         
     }
     void attribute(const char* name, const char* value) { attribute(name, std::strlen(name), value, std::strlen(value)); }
+    // With Flag::Indent, text of only spaces outside mixed content is replaced by the indentation
     void text(const char* value, std::size_t valueLength) {
         
-        stream->write(value, valueLength);
+        if(flag & Flag::Indent && !levels.empty()) {
+            
+            auto& level = levels.back();
+            if(!(level & MIXED) && isSpace(value, valueLength)) return;
+            level |= MIXED;
+            
+        }
+        if(flag & Flag::Escape) writeEscaped<Impl::EscapeText>(value, valueLength);
+        else writer.write(value, valueLength);
         
     }
     void text(const char* value) { text(value, std::strlen(value)); }
     void cdata(const char* value, std::size_t valueLength) {
         
-        stream->write("<![CDATA[", 9);
-        stream->write(value, valueLength);
-        stream->write("]]>", 3);
+        if(flag & Flag::Indent && !levels.empty()) levels.back() |= MIXED;
+        writer.write("<![CDATA[", 9);
+        writer.write(value, valueLength);
+        writer.write("]]>", 3);
         
     }
     void cdata(const char* value) { cdata(value, std::strlen(value)); }
     void comment(const char* value, std::size_t valueLength) {
         
-        stream->write("<!--", 4);
-        stream->write(value, valueLength);
-        stream->write("-->", 3);
+        indentNode();
+        writer.write("<!--", 4);
+        writer.write(value, valueLength);
+        writer.write("-->", 3);
         
     }
     void comment(const char* value) { comment(value, std::strlen(value)); }
     void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
         
-        stream->write("<?", 2);
-        stream->write(name, nameLength);
-        stream->write(" ", 1);
-        stream->write(value, valueLength);
-        stream->write("?>", 2);
+        indentNode();
+        writer.write("<?", 2);
+        writer.write(name, nameLength);
+        writer.write(" ", 1);
+        writer.write(value, valueLength);
+        writer.write("?>", 2);
         
     }
     void processingInstruction(const char* name, const char* value) { processingInstruction(name, std::strlen(name), value, std::strlen(value)); }
     
 };
 
+using Serializer = BasicSerializer<StreamWriter>;
+using BufferedSerializer = BasicSerializer<BufferedStreamWriter>;
+using StringSerializer = BasicSerializer<ContainerWriter<std::string>>;
+
 }
 }
 }
@@ -0,0 +1,182 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_SKIPPER_HPP
+#define CATS_TEXTCAT_XML_SKIPPER_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <type_traits>
+
+#include "Cats/Corecat/Sequence.hpp"
+
+#include "SIMD.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+namespace Impl {
+
+template <typename T, T... V>
+struct Include {
+    
+    static constexpr bool get(T t) { return Corecat::Sequence::Contain<Corecat::Sequence::Base<T, V...>>::get(t); }
+    
+};
+
+template <typename T, T... V>
+struct Exclude {
+    
+    static constexpr bool get(T t) { return !Corecat::Sequence::Contain<Corecat::Sequence::Base<T, V...>>::get(t); }
+    
+};
+
+
+template <typename Cond, typename = void>
+struct Skipper {
+    
+    static size_t skip(char*& p) {
+        
+        using namespace Corecat::Sequence;
+        
+        auto t = p;
+        while(Table<Mapper<Cond, Index<unsigned char, 0, 255>>>::get(*t)) {
+            
+            ++t;
+            
+        }
+        const size_t length = t - p;
+        p = t;
+        return length;
+        
+    }
+    static size_t skip(char*& p, const char* e) {
+        
+        using namespace Corecat::Sequence;
+        
+        auto t = p;
+        while(t != e && Table<Mapper<Cond, Index<unsigned char, 0, 255>>>::get(*t)) {
+            
+            ++t;
+            
+        }
+        const size_t length = t - p;
+        p = t;
+        return length;
+        
+    }
+    
+};
+
+#if defined(CATS_TEXTCAT_XML_SIMD)
+
+// Vectorized skipper for small character sets, stopping at the first byte that is (Stop = true) or is not
+// (Stop = false) in V... . Aligned loads never cross a page boundary, so reading the whole block that holds
+// the terminating NUL is safe.
+template <typename Cond, bool Stop, unsigned char... V>
+struct SkipperSIMD {
+    
+    static SIMD::Mask match(SIMD::Vector t) {
+        
+        auto m = SIMD::mask(SIMD::Any<V...>::get(t));
+        return Stop ? m : ~m & SIMD::FULL;
+        
+    }
+    static SIMD::Mask match(const char* t) { return match(SIMD::load(t)); }
+    
+    static size_t skip(char*& p) {
+        
+        static_assert(!Stop || Corecat::Sequence::Contain<Corecat::Sequence::Base<unsigned char, V...>>::get(0),
+            "the set must stop at the terminating NUL");
+        
+        const std::size_t offset = reinterpret_cast<std::uintptr_t>(p) & (SIMD::WIDTH - 1);
+        auto t = p - offset;
+        auto m = SIMD::shift(match(t), offset);
+        if(m) {
+            
+            t = p + SIMD::first(m);
+            
+        } else {
+            
+            for(t += SIMD::WIDTH; !(m = match(t)); t += SIMD::WIDTH);
+            t += SIMD::first(m);
+            
+        }
+        const size_t length = t - p;
+        p = t;
+        return length;
+        
+    }
+    // Bounded input may end anywhere in a page, so only whole vectors before e are loaded
+    static size_t skip(char*& p, const char* e) {
+        
+        using namespace Corecat::Sequence;
+        
+        auto t = p;
+        for(; static_cast<std::size_t>(e - t) >= SIMD::WIDTH; t += SIMD::WIDTH) {
+            
+            if(auto m = match(SIMD::loadUnaligned(t))) {
+                
+                t += SIMD::first(m);
+                const size_t length = t - p;
+                p = t;
+                return length;
+                
+            }
+            
+        }
+        while(t != e && Table<Mapper<Cond, Index<unsigned char, 0, 255>>>::get(*t)) ++t;
+        const size_t length = t - p;
+        p = t;
+        return length;
+        
+    }
+    
+};
+
+// Larger sets (names) only have short runs, where the table is faster
+template <unsigned char... V>
+struct Skipper<Exclude<unsigned char, V...>, typename std::enable_if<(sizeof...(V) <= 4)>::type> :
+    SkipperSIMD<Exclude<unsigned char, V...>, true, V...> {};
+    
+template <unsigned char... V>
+struct Skipper<Include<unsigned char, V...>, typename std::enable_if<(sizeof...(V) <= 4)>::type> :
+    SkipperSIMD<Include<unsigned char, V...>, false, V...> {};
+
+#endif
+
+}
+
+}
+}
+}
+
+
+#endif
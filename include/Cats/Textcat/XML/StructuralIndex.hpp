@@ -0,0 +1,133 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_STRUCTURALINDEX_HPP
+#define CATS_TEXTCAT_XML_STRUCTURALINDEX_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#   include <intrin.h>
+#endif
+
+#include "SIMD.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Bitmap of the bytes of a document that can end a value or markup: '<', '>', '&', both quotes and NUL. It
+// is built a vector at a time before parsing, so that the parser can jump from one candidate to the next
+// instead of testing every byte. Whether a quote or '>' is structural depends on the names around it, so
+// the bitmap keeps every occurrence and the parser, which knows the context, skips the ones that do not
+// apply.
+class StructuralIndex {
+    
+private:
+    
+    std::vector<std::uint64_t> bits;
+    std::size_t size;
+    
+private:
+    
+    static std::size_t countZero(std::uint64_t m) {
+        
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+        unsigned long i;
+        _BitScanForward64(&i, m);
+        return i;
+#elif defined(_MSC_VER) && !defined(__clang__)
+        unsigned long i;
+        if(_BitScanForward(&i, static_cast<unsigned long>(m))) return i;
+        _BitScanForward(&i, static_cast<unsigned long>(m >> 32));
+        return i + 32;
+#else
+        return __builtin_ctzll(m);
+#endif
+        
+    }
+    static bool isCandidate(char c) {
+        
+        return c == 0 || c == '<' || c == '>' || c == '&' || c == '"' || c == '\'';
+        
+    }
+    
+public:
+    
+    StructuralIndex() : bits(), size() {}
+    StructuralIndex(const StructuralIndex& src) = delete;
+    
+    void build(const char* data, std::size_t size_) {
+        
+        size = size_;
+        bits.assign((size + 63) / 64, 0);
+        std::size_t i = 0;
+#if defined(CATS_TEXTCAT_XML_SIMD)
+        using namespace Impl::SIMD;
+        for(; size - i >= WIDTH; i += WIDTH) {
+            
+            auto m = mask(Any<0, '<', '>', '&', '"', '\''>::get(loadUnaligned(data + i)));
+            if(SCALE == 1) bits[i / 64] |= static_cast<std::uint64_t>(m) << (i % 64);
+            else for(; m; m &= ~(((Mask(1) << SCALE) - 1) << (first(m) * SCALE))) bits[i / 64] |= std::uint64_t(1) << (i % 64 + first(m));
+            
+        }
+#endif
+        for(; i != size; ++i) if(isCandidate(data[i])) bits[i / 64] |= std::uint64_t(1) << (i % 64);
+        
+    }
+    void clear() { bits.clear(); size = 0; }
+    
+    std::size_t getSize() const { return size; }
+    
+    // First candidate at or after offset, or the size of the input
+    std::size_t next(std::size_t offset) const {
+        
+        if(offset >= size) return size;
+        std::size_t w = offset / 64;
+        auto m = bits[w] & (~std::uint64_t(0) << (offset % 64));
+        while(!m) {
+            
+            if(++w == bits.size()) return size;
+            m = bits[w];
+            
+        }
+        return w * 64 + countZero(m);
+        
+    }
+    
+};
+
+}
+}
+}
+
+
+#endif
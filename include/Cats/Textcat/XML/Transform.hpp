@@ -0,0 +1,444 @@
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2016 The Cats Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef CATS_TEXTCAT_XML_TRANSFORM_HPP
+#define CATS_TEXTCAT_XML_TRANSFORM_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Handler.hpp"
+#include "Query.hpp"
+
+
+namespace Cats {
+namespace Textcat{
+namespace XML {
+
+// Forwards every callback to the next handler, which is held by reference when H is a reference type and by
+// value otherwise. Adapters hide the callbacks they change, so a chain of adapters ending in a serializer is one
+// handler type whose calls inline into each other, and directives of the next handler are passed back.
+template <typename H>
+class Adapter : public HandlerBase {
+    
+protected:
+    
+    using Next = typename std::remove_reference<H>::type;
+    
+    H next;
+    
+public:
+    
+    static constexpr Callback CALLBACKS = Impl::Callbacks<Next>::value;
+    
+    explicit Adapter(H&& next_) : next(std::forward<H>(next_)) {}
+    
+    Next& getNext() { return next; }
+    
+    void startDocument() { next.startDocument(); }
+    void endDocument() { next.endDocument(); }
+    auto startElement(const char* name, std::size_t nameLength) -> decltype(std::declval<Next&>().startElement(name, nameLength)) {
+        
+        return next.startElement(name, nameLength);
+        
+    }
+    void endElement(const char* name, std::size_t nameLength) { next.endElement(name, nameLength); }
+    auto endAttributes() -> decltype(std::declval<Next&>().endAttributes()) { return next.endAttributes(); }
+    void skipped(const char* content, std::size_t contentLength) { next.skipped(content, contentLength); }
+    void doctype(const char* name, std::size_t nameLength, const char* publicId, std::size_t publicIdLength,
+        const char* systemId, std::size_t systemIdLength, const char* internalSubset, std::size_t internalSubsetLength) {
+        
+        next.doctype(name, nameLength, publicId, publicIdLength, systemId, systemIdLength, internalSubset, internalSubsetLength);
+        
+    }
+    void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+        
+        next.attribute(name, nameLength, value, valueLength);
+        
+    }
+    void text(const char* value, std::size_t valueLength) { next.text(value, valueLength); }
+    void cdata(const char* value, std::size_t valueLength) { next.cdata(value, valueLength); }
+    void comment(const char* value, std::size_t valueLength) { next.comment(value, valueLength); }
+    void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+        
+        next.processingInstruction(name, nameLength, value, valueLength);
+        
+    }
+    
+};
+
+// Calls rename(name, nameLength) with references to the name of each start and end tag, which it may point
+// elsewhere for the next handler
+template <typename H, typename F>
+class ElementRenamer : public Adapter<H> {
+    
+private:
+    
+    using Next = typename Adapter<H>::Next;
+    
+    F rename;
+    
+public:
+    
+    ElementRenamer(H&& next_, F rename_) : Adapter<H>(std::forward<H>(next_)), rename(std::move(rename_)) {}
+    
+    auto startElement(const char* name, std::size_t nameLength) -> decltype(std::declval<Next&>().startElement(name, nameLength)) {
+        
+        rename(name, nameLength);
+        return this->next.startElement(name, nameLength);
+        
+    }
+    void endElement(const char* name, std::size_t nameLength) {
+        
+        rename(name, nameLength);
+        this->next.endElement(name, nameLength);
+        
+    }
+    
+};
+
+// Like ElementRenamer for the names of attributes
+template <typename H, typename F>
+class AttributeRenamer : public Adapter<H> {
+    
+private:
+    
+    F rename;
+    
+public:
+    
+    AttributeRenamer(H&& next_, F rename_) : Adapter<H>(std::forward<H>(next_)), rename(std::move(rename_)) {}
+    
+    void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+        
+        rename(name, nameLength);
+        this->next.attribute(name, nameLength, value, valueLength);
+        
+    }
+    
+};
+
+// Passes on the attributes for which keep(name, nameLength, value, valueLength) returns true
+template <typename H, typename P>
+class AttributeFilter : public Adapter<H> {
+    
+private:
+    
+    P keep;
+    
+public:
+    
+    AttributeFilter(H&& next_, P keep_) : Adapter<H>(std::forward<H>(next_)), keep(std::move(keep_)) {}
+    
+    void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+        
+        if(keep(name, nameLength, value, valueLength)) this->next.attribute(name, nameLength, value, valueLength);
+        
+    }
+    
+};
+
+// Where Injector calls inject for an element: before its start tag, before the end of its attributes, at the
+// start of its content, before its end tag and after it
+enum class Injection {
+    
+    Before,
+    Attributes,
+    Content,
+    End,
+    After,
+    
+};
+
+// Calls inject(next, injection, name, nameLength) around each element, so that it can send its own callbacks to
+// the next handler. Content and End are left out when the next handler skips the content.
+template <typename H, typename F>
+class Injector : public Adapter<H> {
+    
+private:
+    
+    using Next = typename Adapter<H>::Next;
+    using Void = std::is_void<decltype(std::declval<Next&>().endAttributes())>;
+    
+    F inject;
+    const char* name;
+    std::size_t nameLength;
+    bool skipping;
+    
+private:
+    
+    void startElement(const char* name_, std::size_t nameLength_, std::true_type) { this->next.startElement(name_, nameLength_); }
+    Directive startElement(const char* name_, std::size_t nameLength_, std::false_type) {
+        
+        auto directive = this->next.startElement(name_, nameLength_);
+        skipping = directive == Directive::Skip;
+        return directive;
+        
+    }
+    void endAttributes(std::true_type) {
+        
+        this->next.endAttributes();
+        inject(this->next, Injection::Content, name, nameLength);
+        
+    }
+    Directive endAttributes(std::false_type) {
+        
+        auto directive = this->next.endAttributes();
+        skipping = directive == Directive::Skip;
+        if(directive == Directive::Continue) inject(this->next, Injection::Content, name, nameLength);
+        return directive;
+        
+    }
+    
+public:
+    
+    Injector(H&& next_, F inject_) : Adapter<H>(std::forward<H>(next_)), inject(std::move(inject_)), name(), nameLength(),
+        skipping() {}
+    
+    auto startElement(const char* name_, std::size_t nameLength_) -> decltype(std::declval<Next&>().startElement(name_, nameLength_)) {
+        
+        inject(this->next, Injection::Before, name_, nameLength_);
+        name = name_;
+        nameLength = nameLength_;
+        return startElement(name_, nameLength_, std::is_void<decltype(std::declval<Next&>().startElement(name_, nameLength_))>());
+        
+    }
+    auto endAttributes() -> decltype(std::declval<Next&>().endAttributes()) {
+        
+        inject(this->next, Injection::Attributes, name, nameLength);
+        return endAttributes(Void());
+        
+    }
+    void endElement(const char* name_, std::size_t nameLength_) {
+        
+        if(!skipping) inject(this->next, Injection::End, name_, nameLength_);
+        skipping = false;
+        this->next.endElement(name_, nameLength_);
+        inject(this->next, Injection::After, name_, nameLength_);
+        
+    }
+    
+};
+
+enum class FilterMode {
+    
+    // Leave out the selected elements with their content
+    Drop,
+    // Pass on only the selected elements with their content
+    Keep,
+    
+};
+
+// Filters the elements selected by a query, which must select elements. The start tag of an element the last
+// step may select is held back until its attributes decide, and the attributes are copied. Content that is not
+// passed on is skipped by the parser unless a query step may match below it. The filter refers to the query,
+// which has to outlive it, so temporaries are rejected.
+template <typename H>
+class PathFilter : public Adapter<H> {
+    
+private:
+    
+    struct Ignore { void operator ()(const char*, std::size_t) const {} };
+    
+    struct Pending {
+        
+        std::size_t name;
+        std::size_t nameLength;
+        std::size_t value;
+        std::size_t valueLength;
+        
+    };
+    
+    FilterMode mode;
+    QueryHandler<Ignore> query;
+    // Depth inside the element dropped, or kept, last
+    std::size_t depth;
+    
+    // The start tag held back
+    std::vector<char> strings;
+    std::vector<Pending> pending;
+    bool holding;
+    
+private:
+    
+    bool visible() const { return mode == FilterMode::Drop ? !depth : depth; }
+    std::size_t store(const char* data, std::size_t length) {
+        
+        std::size_t offset = strings.size();
+        strings.insert(strings.end(), data, data + length);
+        return offset;
+        
+    }
+    // Send the start tag held back to the next handler
+    Directive release() {
+        
+        holding = false;
+        auto& element = pending.front();
+        auto directive = Impl::startElement(this->next, strings.data() + element.name, element.nameLength);
+        if(directive != Directive::Continue) return directive;
+        for(auto i = pending.begin() + 1; i != pending.end(); ++i)
+            this->next.attribute(strings.data() + i->name, i->nameLength, strings.data() + i->value, i->valueLength);
+        return Impl::endAttributes(this->next);
+        
+    }
+    
+public:
+    
+    static constexpr Callback CALLBACKS = Impl::Callbacks<typename Adapter<H>::Next>::value | Callback::Attribute;
+    
+    PathFilter(H&& next_, const Query& query_, FilterMode mode_) : Adapter<H>(std::forward<H>(next_)), mode(mode_),
+        query(query_, Ignore()), depth(), strings(), pending(), holding() {
+        
+        if(query_.getTarget() != Query::Target::Element) throw std::invalid_argument("query does not select elements");
+        
+    }
+    PathFilter(H&& next_, const Query&& query_, FilterMode mode_) = delete;
+    
+    void startDocument() { query.startDocument(); depth = 0; holding = false; this->next.startDocument(); }
+    Directive startElement(const char* name, std::size_t nameLength) {
+        
+        if(depth) {
+            
+            ++depth;
+            if(mode == FilterMode::Drop) return Directive::Skip;
+            return Impl::startElement(this->next, name, nameLength);
+            
+        }
+        auto directive = query.startElement(name, nameLength);
+        if(query.isCandidate()) {
+            
+            strings.clear();
+            pending.assign(1, {store(name, nameLength), nameLength, 0, 0});
+            holding = true;
+            return Directive::Continue;
+            
+        }
+        if(mode == FilterMode::Keep) return directive;
+        return Impl::startElement(this->next, name, nameLength);
+        
+    }
+    void attribute(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+        
+        if(depth) { if(mode == FilterMode::Keep) this->next.attribute(name, nameLength, value, valueLength); return; }
+        query.attribute(name, nameLength, value, valueLength);
+        if(holding) {
+            
+            auto nameOffset = store(name, nameLength);
+            pending.push_back({nameOffset, nameLength, store(value, valueLength), valueLength});
+            
+        } else if(mode == FilterMode::Drop) this->next.attribute(name, nameLength, value, valueLength);
+        
+    }
+    Directive endAttributes() {
+        
+        if(depth) return mode == FilterMode::Keep ? Impl::endAttributes(this->next) : Directive::Skip;
+        auto directive = query.endAttributes();
+        if(!holding) return mode == FilterMode::Keep ? directive : Impl::endAttributes(this->next);
+        bool selected = query.isSelected();
+        if(selected) depth = 1;
+        if(selected == (mode == FilterMode::Keep)) return release();
+        holding = false;
+        return mode == FilterMode::Keep ? directive : Directive::Skip;
+        
+    }
+    void endElement(const char* name, std::size_t nameLength) {
+        
+        if(depth > 1 || (depth == 1 && mode == FilterMode::Keep)) {
+            
+            if(mode == FilterMode::Keep) this->next.endElement(name, nameLength);
+            if(--depth) return;
+            
+        } else if(depth == 1) depth = 0;
+        else if(mode == FilterMode::Drop) this->next.endElement(name, nameLength);
+        query.endElement(name, nameLength);
+        
+    }
+    void skipped(const char* content, std::size_t contentLength) { if(visible()) this->next.skipped(content, contentLength); }
+    void doctype(const char* name, std::size_t nameLength, const char* publicId, std::size_t publicIdLength,
+        const char* systemId, std::size_t systemIdLength, const char* internalSubset, std::size_t internalSubsetLength) {
+        
+        if(visible())
+            this->next.doctype(name, nameLength, publicId, publicIdLength, systemId, systemIdLength, internalSubset, internalSubsetLength);
+        
+    }
+    void text(const char* value, std::size_t valueLength) { if(visible()) this->next.text(value, valueLength); }
+    void cdata(const char* value, std::size_t valueLength) { if(visible()) this->next.cdata(value, valueLength); }
+    void comment(const char* value, std::size_t valueLength) { if(visible()) this->next.comment(value, valueLength); }
+    void processingInstruction(const char* name, std::size_t nameLength, const char* value, std::size_t valueLength) {
+        
+        if(visible()) this->next.processingInstruction(name, nameLength, value, valueLength);
+        
+    }
+    
+};
+
+// The adapters take the next handler by reference when it is an lvalue, so chains are built inside out:
+// createAttributeFilter(createElementRenamer(serializer, rename), keep)
+template <typename H, typename F>
+inline ElementRenamer<H, F> createElementRenamer(H&& next, F rename) {
+    
+    return ElementRenamer<H, F>(std::forward<H>(next), std::move(rename));
+    
+}
+template <typename H, typename F>
+inline AttributeRenamer<H, F> createAttributeRenamer(H&& next, F rename) {
+    
+    return AttributeRenamer<H, F>(std::forward<H>(next), std::move(rename));
+    
+}
+template <typename H, typename P>
+inline AttributeFilter<H, P> createAttributeFilter(H&& next, P keep) {
+    
+    return AttributeFilter<H, P>(std::forward<H>(next), std::move(keep));
+    
+}
+template <typename H, typename F>
+inline Injector<H, F> createInjector(H&& next, F inject) {
+    
+    return Injector<H, F>(std::forward<H>(next), std::move(inject));
+    
+}
+template <typename H>
+inline PathFilter<H> createPathFilter(H&& next, const Query& query, FilterMode mode) {
+    
+    return PathFilter<H>(std::forward<H>(next), query, mode);
+    
+}
+template <typename H>
+PathFilter<H> createPathFilter(H&& next, const Query&& query, FilterMode mode) = delete;
+
+}
+}
+}
+
+
+#endif